@@ -0,0 +1,628 @@
+#include <Ice/Ice.h>
+#include "system.h"
+#include "tram.h"
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <ctime>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+using namespace SIP;
+
+// liczba alokacji we wszystkich watkach procesu (takze w puli watkow Ice)
+static atomic<long long> allocations{0};
+
+void *operator new(size_t size) {
+    allocations++;
+    void *memory = malloc(size == 0 ? 1 : size);
+    if (!memory) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+
+// wyniki ida na oryginalny stdout, a logi servantow sa wyciszane
+static ostream report(cout.rdbuf());
+
+struct Result {
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+// mierzy sredni czas i liczbe alokacji jednej operacji
+template<typename F>
+Result measure(int iterations, F operation) {
+    long long allocationsBefore = allocations;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        operation(i);
+    }
+    auto end = chrono::steady_clock::now();
+    Result result;
+    result.nsPerOp = chrono::duration<double, nano>(end - start).count() / iterations;
+    result.allocsPerOp = static_cast<double>(allocations - allocationsBefore) / iterations;
+    return result;
+}
+
+void printResult(string operation, string parameter, int size, Result result) {
+    report << operation << "\t" << parameter << "=" << size
+           << "\t" << result.nsPerOp << " ns/op\t" << result.allocsPerOp << " allocs/op" << endl;
+}
+
+Time minutesFromNow(int minutes) {
+    time_t now = time(nullptr);
+    tm timeNow;
+    localtime_r(&now, &timeNow);
+    int total = timeNow.tm_hour * 60 + timeNow.tm_min + minutes;
+    Time time;
+    time.hour = (total / 60) % 24;
+    time.minute = total % 60;
+    return time;
+}
+
+// pasazer, ktory tylko przyjmuje powiadomienia
+class SilentPassenger : public SIP::Passenger {
+public:
+    void updateTramInfo(shared_ptr <TramPrx> tram, StopList stops, const Ice::Current &current) override {}
+
+    void updateStopInfo(shared_ptr <TramStopPrx> tramStop, TramList tramList, const Ice::Current &current) override {}
+
+    void notifyPassenger(string info, const Ice::Current &current) override {}
+};
+
+// Siec servantow na wlasnym adapterze z endpointem TCP na localhost. Obiekty z mapy servantow
+// sa wolane sciezka kolokowana, a przystanki (servant locator) i pasazerowie (servant domyslny)
+// przez petle zwrotna, bo kolokacja rozwiazuje tylko tozsamosci z mapy. Adapter jest
+// niszczony razem z siecia.
+class Network {
+public:
+    Ice::ObjectAdapterPtr adapter;
+    shared_ptr <MPK_I> mpk = make_shared<MPK_I>();
+    shared_ptr <NotificationEngine> notifier = make_shared<NotificationEngine>();
+    shared_ptr <StopFactoryI> stopFactory;
+    shared_ptr <LineFactoryI> lineFactory;
+    shared_ptr <MPKPrx> mpkPrx;
+
+    Network(Ice::CommunicatorPtr ic) {
+        adapter = ic->createObjectAdapterWithEndpoints("", "tcp -h 127.0.0.1");
+        adapter->addDefaultServant(make_shared<SilentPassenger>(), "bench");
+        stopFactory = make_shared<StopFactoryI>(adapter, notifier, mpk->getIds());
+        lineFactory = make_shared<LineFactoryI>(adapter, mpk->getTopology(), mpk->getIds());
+        mpkPrx = Ice::uncheckedCast<MPKPrx>(adapter->addWithUUID(mpk));
+        adapter->activate();
+    }
+
+    ~Network() {
+        adapter->destroy();
+    }
+
+    shared_ptr <TramStopPrx> createStop(string name) {
+        auto stopPrx = stopFactory->createStop(name, Ice::Current());
+        mpk->addStop(name, stopPrx);
+        return stopPrx;
+    }
+
+    // proxy bez servanta - dla operacji, ktore nie wywoluja obiektu, ktory dostaja
+    template<typename Prx>
+    shared_ptr <Prx> dangling(string name) {
+        return Ice::uncheckedCast<Prx>(adapter->createProxy(Ice::stringToIdentity(name)));
+    }
+
+    shared_ptr <LinePrx> createLine(string name, int stopsCount) {
+        auto linePrx = lineFactory->createLine(name, Ice::Current());
+        StopList stops;
+        for (int i = 0; i < stopsCount; ++i) {
+            StopInfo stopInfo;
+            stopInfo.stop = createStop(name + "/" + to_string(i));
+            stops.push_back(stopInfo);
+        }
+        linePrx->setStops(stops);
+        mpkPrx->addLine(linePrx);
+        return linePrx;
+    }
+
+    shared_ptr <TramPrx> createTram(string stockNumber) {
+        auto tram = make_shared<TramI>(stockNumber, notifier, mpk->getIds());
+        auto tramPrx = Ice::uncheckedCast<TramPrx>(adapter->addWithUUID(tram));
+        tram->setProxy(tramPrx);
+        return tramPrx;
+    }
+
+    shared_ptr <PassengerPrx> passenger(int index) {
+        return Ice::uncheckedCast<PassengerPrx>(adapter->createProxy(Ice::Identity{to_string(index), "bench"}));
+    }
+};
+
+void benchGetTramStop(Ice::CommunicatorPtr ic) {
+    for (int stopsCount: {10, 100, 1000, 10000, 100000}) {
+        Network network(ic);
+        vector <string> names;
+        for (int i = 0; i < stopsCount; ++i) {
+            string name = "Przystanek" + to_string(i);
+            // rejestr nie moze wykonywac zadnych wywolan na przystankach
+            network.mpk->addStop(name, network.dangling<TramStopPrx>(name));
+            names.push_back(name);
+        }
+
+        printResult("getTramStop", "stops", stopsCount, measure(1000000, [&](int i) {
+            network.mpk->getTramStop(names[i % stopsCount], Ice::Current());
+        }));
+        printResult("getTramStop(miss)", "stops", stopsCount, measure(1000000, [&](int i) {
+            network.mpk->getTramStop("Brak", Ice::Current());
+        }));
+        printResult("getTramStop(prx)", "stops", stopsCount, measure(100000, [&](int i) {
+            network.mpkPrx->getTramStop(names[i % stopsCount]);
+        }));
+    }
+}
+
+void benchArrivals(Ice::CommunicatorPtr ic) {
+    for (int tramsCount: {10, 100, 1000, 10000}) {
+        Network network(ic);
+        auto stopPrx = network.createStop("Tablica");
+        vector <shared_ptr<TramPrx>> trams;
+        for (int i = 0; i < tramsCount; ++i) {
+            // tablica przyjazdow nie wywoluje tramwajow
+            trams.push_back(network.dangling<TramPrx>("t" + to_string(i)));
+            stopPrx->UpdateTramInfo(trams.back(), minutesFromNow(1 + i % 600));
+        }
+
+        printResult("UpdateTramInfo", "trams", tramsCount, measure(100000, [&](int i) {
+            stopPrx->UpdateTramInfo(trams[i % tramsCount], minutesFromNow(1 + (i * 7) % 600));
+        }));
+        printResult("getNextTrams(5)", "trams", tramsCount, measure(100000, [&](int i) {
+            stopPrx->getNextTrams(5);
+        }));
+        printResult("getNextTrams(50)", "trams", tramsCount, measure(100000, [&](int i) {
+            stopPrx->getNextTrams(50);
+        }));
+    }
+}
+
+void benchRegisterTram(Ice::CommunicatorPtr ic) {
+    for (int tramsCount: {10, 100, 1000}) {
+        Network network(ic);
+        auto linePrx = network.createLine("L", 10);
+        vector <shared_ptr<TramPrx>> trams;
+        for (int i = 0; i < tramsCount; ++i) {
+            trams.push_back(network.createTram(to_string(i)));
+        }
+
+        printResult("registerTram", "trams", tramsCount, measure(tramsCount, [&](int i) {
+            linePrx->registerTram(trams[i]);
+        }));
+        printResult("getTrams", "trams", tramsCount, measure(10000, [&](int i) {
+            linePrx->getTrams();
+        }));
+        printResult("unregisterTram", "trams", tramsCount, measure(tramsCount, [&](int i) {
+            linePrx->unregisterTram(trams[tramsCount - 1 - i]);
+        }));
+    }
+}
+
+void benchNetwork(Ice::CommunicatorPtr ic) {
+    for (int linesCount: {1, 10, 100}) {
+        Network network(ic);
+        for (int i = 0; i < linesCount; ++i) {
+            network.createLine(to_string(i), 20);
+        }
+
+        printResult("getLines", "lines", linesCount, measure(10000, [&](int i) {
+            network.mpkPrx->getLines();
+        }));
+        printResult("getNetwork", "lines", linesCount, measure(1000, [&](int i) {
+            network.mpkPrx->getNetwork();
+        }));
+    }
+}
+
+void benchFanOut(Ice::CommunicatorPtr ic) {
+    for (int subscribersCount: {10, 100, 1000, 10000}) {
+        Network network(ic);
+        auto stopPrx = network.createStop("Fanout");
+        auto tramPrx = network.createTram("1");
+        for (int i = 0; i < subscribersCount; ++i) {
+            stopPrx->RegisterPassenger(network.passenger(i));
+        }
+
+        const int rounds = 20;
+        Result result = measure(rounds, [&](int i) {
+            stopPrx->addCurrentTram(tramPrx);
+            stopPrx->removeCurrentTram(tramPrx);
+        });
+
+        // kazde powiadomienie konczy sie dostarczeniem, bledem, scaleniem albo odrzuceniem
+        const Ice::Long expected = static_cast<Ice::Long>(rounds) * subscribersCount;
+        auto start = chrono::steady_clock::now();
+        NotificationEngine::Stats stats;
+        while (true) {
+            stats = network.notifier->getStats();
+            if (stats.delivered + stats.failed + stats.coalesced + stats.dropped >= expected) {
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        double drainSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        printResult("addCurrentTram", "subscribers", subscribersCount, result);
+        report << "fanout\tsubscribers=" << subscribersCount
+               << "\tdelivered " << stats.delivered << " coalesced " << stats.coalesced
+               << " dropped " << stats.dropped << " failed " << stats.failed << " dead " << stats.dead
+               << "\tdrain " << drainSeconds * 1000 << " ms" << endl;
+    }
+}
+
+// Subskrypcja i rezygnacja maja kosztowac tyle samo przy 1000 i 100000 pasazerach przystanku;
+// ponowna subskrypcja tego samego pasazera nie moze powiekszac listy.
+void benchSubscribers(Ice::CommunicatorPtr ic) {
+    for (int subscribersCount: {1000, 10000, 100000}) {
+        Network network(ic);
+        auto stopPrx = network.createStop("Subskrypcje");
+        for (int i = 0; i < subscribersCount; ++i) {
+            stopPrx->RegisterPassenger(network.passenger(i));
+        }
+
+        printResult("RegisterPassenger(again)", "subscribers", subscribersCount, measure(10000, [&](int i) {
+            stopPrx->RegisterPassenger(network.passenger((i * 7919) % subscribersCount));
+        }));
+        printResult("Unregister+RegisterPassenger", "subscribers", subscribersCount, measure(10000, [&](int i) {
+            auto passenger = network.passenger((i * 7919) % subscribersCount);
+            stopPrx->UnregisterPassenger(passenger);
+            stopPrx->RegisterPassenger(passenger);
+        }));
+    }
+}
+
+// Subskrybenci z filtrami rozlozeni na 100 linii i rozne progi minut: zmiana czasu przyjazdu
+// jednej linii powinna kosztowac tyle, ilu pasazerow pasuje, a nie ilu jest na przystanku.
+void benchFilteredSubscriptions(Ice::CommunicatorPtr ic) {
+    for (int subscribersCount: {100, 1000, 10000, 100000}) {
+        Network network(ic);
+        auto stopPrx = network.createStop("Filtry");
+        for (int i = 0; i < subscribersCount; ++i) {
+            SubscriptionFilter filter;
+            filter.lines.push_back(to_string(i % 100));
+            filter.nextArrivals = 0;
+            filter.withinMinutes = 1 + i % 30;
+            stopPrx->RegisterFilteredPassenger(network.passenger(i), filter);
+        }
+        auto tram = network.dangling<TramPrx>("tram");
+        printResult("UpdateLineTramInfo(filtered)", "subscribers", subscribersCount, measure(10000, [&](int i) {
+            stopPrx->UpdateLineTramInfo(tram, "7", minutesFromNow(20 + i % 10));
+        }));
+        NotificationEngine::Stats stats = network.notifier->getStats();
+        report << "filtered\tsubscribers=" << subscribersCount << "\tpublished " << stats.published << endl;
+    }
+}
+
+// uruchamia te sama operacje odczytu w `threads` watkach i zwraca laczna przepustowosc
+template<typename F>
+double throughput(int threads, int iterations, F operation) {
+    vector <thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (int i = 0; i < iterations; ++i) {
+                operation(t * iterations + i);
+            }
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    auto end = chrono::steady_clock::now();
+    return threads * iterations / chrono::duration<double>(end - start).count();
+}
+
+void benchConcurrentReads(Ice::CommunicatorPtr ic) {
+    const int stopsCount = 1000;
+    const int linesCount = 50;
+    Network network(ic);
+    auto stop = make_shared<TramStopI>("Odczyty", network.notifier, network.mpk->getIds());
+    vector <string> names;
+    for (int i = 0; i < stopsCount; ++i) {
+        string name = "Przystanek" + to_string(i);
+        network.mpk->addStop(name, network.dangling<TramStopPrx>(name));
+        names.push_back(name);
+    }
+    for (int i = 0; i < linesCount; ++i) {
+        network.createLine("linia" + to_string(i), 0);
+    }
+    for (int i = 0; i < 100; ++i) {
+        stop->UpdateTramInfo(network.dangling<TramPrx>("tram" + to_string(i)), minutesFromNow(1 + i), Ice::Current());
+    }
+
+    const int iterations = 200000;
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    for (int threads = 1; threads <= static_cast<int>(cores); threads *= 2) {
+        double stops = throughput(threads, iterations, [&](int i) {
+            network.mpk->getTramStop(names[i % stopsCount], Ice::Current());
+        });
+        double nextTrams = throughput(threads, iterations, [&](int i) {
+            stop->getNextTrams(5, Ice::Current());
+        });
+        double lines = throughput(threads, iterations / 10, [&](int i) {
+            network.mpk->getLines(Ice::Current());
+        });
+        report << "reads\tthreads=" << threads
+               << "\tgetTramStop " << static_cast<long>(stops) << " op/s"
+               << "\tgetNextTrams " << static_cast<long>(nextTrams) << " op/s"
+               << "\tgetLines " << static_cast<long>(lines) << " op/s" << endl;
+    }
+}
+
+// Ogloszenie calego rozkladu tramwaju: wywolanie na przystanek, jedno wywolanie na linii
+// i ponowne ogloszenie, w ktorym przesunal sie tylko jeden czas.
+void benchTimetable(Ice::CommunicatorPtr ic) {
+    for (int stopsCount: {10, 50, 200}) {
+        Network network(ic);
+        auto linePrx = network.createLine("L", stopsCount);
+        StopList timetable = linePrx->getStops();
+        for (int i = 0; i < stopsCount; ++i) {
+            timetable.at(i).time = minutesFromNow(1 + i);
+        }
+        auto tram = network.dangling<TramPrx>("tram");
+
+        printResult("UpdateTramInfo(all stops)", "stops", stopsCount, measure(100, [&](int i) {
+            for (const auto &stopInfo: timetable) {
+                stopInfo.stop->UpdateTramInfo(tram, stopInfo.time);
+            }
+        }));
+        int round = 0;
+        printResult("publishTimetable(full)", "stops", stopsCount, measure(100, [&](int i) {
+            // kazda runda przesuwa wszystkie czasy, wiec linia wysyla caly rozklad
+            ++round;
+            StopList shifted = timetable;
+            for (int j = 0; j < stopsCount; ++j) {
+                shifted.at(j).time = minutesFromNow(1 + j + round % 2);
+            }
+            linePrx->publishTimetable(tram, shifted);
+        }));
+        printResult("publishTimetable(1 changed)", "stops", stopsCount, measure(100, [&](int i) {
+            timetable.at(stopsCount / 2).time = minutesFromNow(1 + stopsCount / 2 + i % 2);
+            linePrx->publishTimetable(tram, timetable);
+        }));
+
+        // ogloszony rozklad musi dotrzec na tablice - inaczej wyzej mierzone sa wysylki donikad
+        auto checked = network.dangling<TramPrx>("sprawdzenie");
+        linePrx->publishTimetable(checked, timetable);
+        int delivered = 0;
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(2);
+        while (delivered < stopsCount && chrono::steady_clock::now() < deadline) {
+            delivered = 0;
+            for (const auto &stopInfo: timetable) {
+                for (const auto &tramInfo: stopInfo.stop->getNextTrams(stopsCount + 2)) {
+                    if (tramInfo.tram->ice_getIdentity() == checked->ice_getIdentity()) {
+                        delivered++;
+                        break;
+                    }
+                }
+            }
+            if (delivered < stopsCount) {
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        }
+        report << "timetable\tstops=" << stopsCount << "\tdelivered " << delivered << "/" << stopsCount
+               << (delivered == stopsCount ? "" : "\tBLAD: rozklad nie dotarl na tablice") << endl;
+    }
+}
+
+template<typename T>
+size_t encodedSize(Ice::CommunicatorPtr ic, const T &value) {
+    Ice::OutputStream out(ic);
+    out.write(value);
+    vector <Ice::Byte> bytes;
+    out.finished(bytes);
+    return bytes.size();
+}
+
+void printSize(string operation, int size, size_t full, size_t compact) {
+    report << "wire\t" << operation << "\tn=" << size << "\tproxies " << full << " B\tids " << compact
+           << " B\t" << static_cast<double>(full) / compact << "x" << endl;
+}
+
+// Rozmiar odpowiedzi z pelnymi proxy i z samymi id. Proxy maja endpointy takie, jakie
+// widzi klient w sieci, bo bez nich kolokowane proxy bylyby nierealnie krotkie.
+void benchWireSize(Ice::CommunicatorPtr ic) {
+    for (int size: {10, 50, 200}) {
+        Network network(ic);
+        auto remote = [&]() {
+            return ic->stringToProxy(Ice::generateUUID() + ":tcp -h 192.168.1.10 -p 10000 -t 8000");
+        };
+        auto linePrx = network.lineFactory->createLine("L", Ice::Current());
+        StopList stops;
+        for (int i = 0; i < size; ++i) {
+            string name = "Przystanek" + to_string(i);
+            StopInfo stopInfo;
+            stopInfo.stop = Ice::uncheckedCast<TramStopPrx>(remote());
+            stopInfo.time = minutesFromNow(i);
+            network.mpk->addStop(name, stopInfo.stop);
+            stops.push_back(stopInfo);
+        }
+        linePrx->setStops(stops);
+        auto stopPrx = network.createStop("Tablica");
+        for (int i = 0; i < size; ++i) {
+            auto tram = Ice::uncheckedCast<TramPrx>(remote());
+            network.mpk->getTopology()->addTram(linePrx->ice_getIdentity(), to_string(i), tram);
+            stopPrx->UpdateTramInfo(tram, minutesFromNow(1 + i));
+        }
+
+        printSize("getStops", size, encodedSize(ic, linePrx->getStops()), encodedSize(ic, linePrx->getStopIds()));
+        // getTrams linii zwraca te same TramList/TramTimeList co tablica przystanku
+        printSize("getNextTrams/getTrams", size, encodedSize(ic, stopPrx->getNextTrams(size)),
+                  encodedSize(ic, stopPrx->getNextTramIds(size)));
+    }
+}
+
+// Cala tablica przyjazdow po 5: dotychczasowe pobieranie coraz dluzszego prefiksu
+// (O(n^2) bajtow) i strony z kursora (kazdy przyjazd raz).
+void benchPaging(Ice::CommunicatorPtr ic) {
+    const int pageSize = 5;
+    for (int tramsCount: {10, 100, 1000}) {
+        Network network(ic);
+        auto stopPrx = network.createStop("Strony");
+        for (int i = 0; i < tramsCount; ++i) {
+            stopPrx->UpdateTramInfo(network.dangling<TramPrx>("t" + to_string(i)), minutesFromNow(1 + i % 600));
+        }
+
+        size_t prefixBytes = 0;
+        printResult("getNextTramIds(prefix)", "trams", tramsCount, measure(10, [&](int i) {
+            size_t fetched = 0;
+            for (int howMany = pageSize;; howMany += pageSize) {
+                TramTimeList batch = stopPrx->getNextTramIds(howMany);
+                prefixBytes += encodedSize(ic, batch);
+                if (batch.size() == fetched) {
+                    break;
+                }
+                fetched = batch.size();
+            }
+        }));
+        size_t cursorBytes = 0;
+        printResult("getNextTramPage", "trams", tramsCount, measure(10, [&](int i) {
+            Ice::Long cursor = 0;
+            do {
+                TramTimePage page = stopPrx->getNextTramPage(cursor, pageSize);
+                cursorBytes += encodedSize(ic, page);
+                cursor = page.cursor;
+            } while (cursor != 0);
+        }));
+        report << "paging\ttrams=" << tramsCount << "\tprefix " << prefixBytes / 10
+               << " B\tcursor " << cursorBytes / 10 << " B" << endl;
+    }
+}
+
+// Wiele przystankow, z ktorych uzywana jest tylko czesc: w pamieci zostaja servanty
+// co najwyzej `resident` ostatnio uzywanych, reszta kosztuje tylko wpis z nazwa.
+void benchEvictor(Ice::CommunicatorPtr ic) {
+    const int stopsCount = 100000;
+    const size_t resident = 1000;
+    for (int activeCount: {100, 1000, 10000}) {
+        Network network(ic);
+        auto adapter = ic->createObjectAdapterWithEndpoints("", "tcp -h 127.0.0.1");
+        auto stopFactory = make_shared<StopFactoryI>(adapter, network.notifier, network.mpk->getIds(), resident);
+        adapter->activate();
+        vector <shared_ptr<TramStopPrx>> stops;
+        long long allocationsBefore = allocations;
+        for (int i = 0; i < stopsCount; ++i) {
+            stops.push_back(stopFactory->createStop("Przystanek" + to_string(i), Ice::Current()));
+        }
+        double allocsPerStop = static_cast<double>(allocations - allocationsBefore) / stopsCount;
+        auto tram = network.dangling<TramPrx>("tram");
+
+        printResult("UpdateTramInfo(evictor)", "active", activeCount, measure(100000, [&](int i) {
+            stops[(i * 7919) % activeCount]->UpdateTramInfo(tram, minutesFromNow(1 + i % 60));
+        }));
+        report << "evictor\tactive=" << activeCount << "\tstops " << stopsCount
+               << "\tresident " << stopFactory->getResidentStops()
+               << "\tcreate " << allocsPerStop << " allocs/stop" << endl;
+        adapter->destroy();
+    }
+}
+
+// Kazdy shard ma wlasny komunikator z jednowatkowa pula serwera i endpointem TCP na localhost,
+// co odpowiada osobnemu procesowi na jednym rdzeniu. MPK i klienci rozmawiaja z nim przez TCP.
+class StopShard {
+public:
+    Ice::CommunicatorPtr communicator;
+    shared_ptr <StopFactoryPrx> factory;
+
+    StopShard(Ice::CommunicatorPtr ic, shared_ptr <IdDirectory> ids) {
+        Ice::InitializationData initData;
+        initData.properties = Ice::createProperties();
+        initData.properties->setProperty("Ice.ThreadPool.Server.Size", "1");
+        communicator = Ice::initialize(initData);
+        auto adapter = communicator->createObjectAdapterWithEndpoints("", "tcp -h 127.0.0.1");
+        auto stopFactory = make_shared<StopFactoryI>(adapter, make_shared<NotificationEngine>(), ids);
+        auto prx = adapter->addWithUUID(stopFactory);
+        adapter->activate();
+        // proxy w komunikatorze benchmarku, zeby wywolania nie szly sciezka kolokowana
+        factory = Ice::uncheckedCast<StopFactoryPrx>(ic->stringToProxy(prx->ice_toString()));
+    }
+
+    ~StopShard() {
+        communicator->destroy();
+    }
+};
+
+void benchShards(Ice::CommunicatorPtr ic) {
+    const int stopsCount = 256;
+    const int iterations = 5000;
+    unsigned threads = max(4u, thread::hardware_concurrency());
+    for (int shardsCount: {1, 2, 4, 8}) {
+        Network network(ic);
+        vector <unique_ptr<StopShard>> shards;
+        for (int i = 0; i < shardsCount; ++i) {
+            shards.emplace_back(new StopShard(ic, network.mpk->getIds()));
+            network.mpk->registerStopShard(shards.back()->factory, Ice::Current());
+        }
+        vector <shared_ptr<TramStopPrx>> stops;
+        for (int i = 0; i < stopsCount; ++i) {
+            stops.push_back(network.mpk->placeStop("Przystanek" + to_string(i)));
+        }
+        auto tram = network.dangling<TramPrx>("tram");
+
+        double rate = throughput(static_cast<int>(threads), iterations, [&](int i) {
+            auto &stop = stops[i % stopsCount];
+            stop->UpdateTramInfo(tram, minutesFromNow(1 + i % 60));
+            stop->getNextTrams(5);
+        });
+        report << "shards\tshards=" << shardsCount << "\tthreads=" << threads
+               << "\t" << static_cast<long>(rate * 2) << " op/s" << endl;
+
+        if (shardsCount == 1) {
+            continue;
+        }
+        // odejscie shardu przenosi jego przystanki do pozostalych
+        auto start = chrono::steady_clock::now();
+        network.mpk->unregisterStopShard(shards.back()->factory, Ice::Current());
+        report << "shards\tshards=" << shardsCount << "\tunregister "
+               << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Ice::CommunicatorPtr ic;
+    // servanty loguja kazda operacje na cout - w benchmarku to tylko szum
+    cout.rdbuf(nullptr);
+    try {
+        ic = Ice::initialize(argc, argv);
+
+        benchGetTramStop(ic);
+        benchArrivals(ic);
+        benchRegisterTram(ic);
+        benchNetwork(ic);
+        benchFanOut(ic);
+        benchFilteredSubscriptions(ic);
+        benchSubscribers(ic);
+        benchConcurrentReads(ic);
+        benchEvictor(ic);
+        benchTimetable(ic);
+        benchWireSize(ic);
+        benchPaging(ic);
+        benchShards(ic);
+    } catch (const Ice::Exception &e) {
+        report << e << endl;
+    }
+
+    if (ic) {
+        try {
+            ic->destroy();
+        } catch (const Ice::Exception &e) {
+            report << e << endl;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#include <Ice/Ice.h>
+#include "system.h"
+#include "simulation.h"
+#include "threadpool.h"
+#include "netload.h"
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+using namespace SIP;
+
+// Caly system w jednym procesie: MPK, zajezdnia, fabryki, przystanki, linie, flota tramwajow
+// i pasazerowie na jednym adapterze. Obiekty z mapy servantow sa wolane sciezka kolokowana Ice
+// (bez polaczen i bez kodowania do sieci). Przystanki (servant locator) i pasazerowie symulacji
+// (servant domyslny) nie sa w tej mapie, wiec kolokacja ich nie znajduje - do nich wywolania
+// ida przez endpoint na petli zwrotnej. Wynik jest do porownania z ./system i ./simulator
+// uruchomionymi z tymi samymi parametrami.
+int main(int argc, char *argv[]) {
+    Ice::CommunicatorPtr ic;
+    try {
+        ic = initializeWithThreadPool(argc, argv);
+        SimulationOptions options;
+        options.fleetFileName = argc > 1 ? argv[1] : "fleet.txt";
+        options.dwellMs = argc > 2 ? stoi(argv[2]) : 2000;
+        options.travelMs = argc > 3 ? stoi(argv[3]) : 8000;
+        options.durationS = argc > 4 ? stoi(argv[4]) : 60;
+        options.workersCount = argc > 5 ? stoi(argv[5]) : 8;
+        options.passengersCount = argc > 6 ? stoi(argv[6]) : 0;
+
+        //endpoint tylko na localhost - z zewnatrz do servantow nie da sie dojsc
+        Ice::ObjectAdapterPtr adapter = ic->createObjectAdapterWithEndpoints("CollocatedAdapter", "tcp -h 127.0.0.1");
+
+        //servanty jak w ./system, takze opakowane w TimedServant, zeby metryki byly porownywalne
+        auto mpk = make_shared<MPK_I>();
+        auto mpkPrx = Ice::uncheckedCast<MPKPrx>(
+                adapter->add(make_shared<TimedServant>(mpk), Ice::stringToIdentity("mpk")));
+
+        auto depo = make_shared<DepoI>("Zajezdnia1", mpk->getTopology());
+        auto depoPrx = Ice::uncheckedCast<DepoPrx>(adapter->addWithUUID(make_shared<TimedServant>(depo)));
+        mpk->registerDepo(depoPrx, Ice::Current());
+
+        auto lineFactory = make_shared<LineFactoryI>(adapter, mpk->getTopology(), mpk->getIds());
+        auto lineFactoryPrx = Ice::uncheckedCast<LineFactoryPrx>(
+                adapter->addWithUUID(make_shared<TimedServant>(lineFactory)));
+        mpk->registerLineFactory(lineFactoryPrx, Ice::Current());
+
+        //jeden silnik powiadomien dla przystankow i tramwajow
+        auto notifier = make_shared<NotificationEngine>();
+        size_t residentStops = ic->getProperties()->getPropertyAsIntWithDefault("MPK.ResidentStops", 1000);
+        auto stopFactory = make_shared<StopFactoryI>(adapter, notifier, mpk->getIds(), residentStops);
+        auto stopFactoryPrx = Ice::uncheckedCast<StopFactoryPrx>(
+                adapter->addWithUUID(make_shared<TimedServant>(stopFactory)));
+        mpk->registerStopFactory(stopFactoryPrx, Ice::Current());
+
+        auto metrics = make_shared<MetricsAdminI>(notifier);
+
+        //wywolania kolokowane tez czekaja na aktywny adapter
+        adapter->activate();
+        loadNetwork(*mpk);
+
+        runSimulation(adapter, mpkPrx, notifier, options);
+        printMetrics(cout, metrics->getMetrics());
+
+    } catch (const Ice::Exception &e) {
+        cout << e << endl;
+    } catch (const char *msg) {
+        cout << msg << endl;
+    }
+
+    if (ic) {
+        try {
+            ic->destroy();
+        } catch (const Ice::Exception &e) {
+            cout << e << endl;
+        }
+    }
+
+    cout << "Koniec symulacji" << endl;
+}
@@ -0,0 +1,139 @@
+#include <Ice/Ice.h>
+#include "system.h"
+#include "threadpool.h"
+#include <iostream>
+#include <memory>
+#include <fstream>
+#include <string>
+
+using namespace std;
+using namespace SIP;
+
+// Osobny proces z fabryka linii i fabryka przystankow. MPK tworzy w nim servanty,
+// gdy jest najmniej obciazony, dzieki czemu duza siec mozna rozlozyc na kilka rdzeni lub hostow.
+// Uruchomiony z argumentem `shard` proces jest shardem przystankow: dostaje przystanki,
+// ktorych nazwy wskazuje mu pierscien spojnego haszowania w MPK.
+int main(int argc, char *argv[]) {
+    string address = "";
+    string port = "";
+    string name = "";
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <factoryPort ex. 10030> [shard]" << endl;
+        return 1;
+    }
+    string factoryPort = argv[1];
+    bool shard = argc > 2 && string(argv[2]) == "shard";
+    ifstream configFile("configfile.txt");
+    if (configFile.is_open()) {
+        string line;
+        while (getline(configFile, line)) {
+            istringstream iss(line);
+            string key, value;
+
+            if (getline(iss, key, '=') && getline(iss, value)) {
+                key.erase(remove_if(key.begin(), key.end(), ::isspace), key.end());
+                value.erase(remove_if(value.begin(), value.end(), ::isspace), value.end());
+
+                if (key == "address") {
+                    address = value;
+                } else if (key == "port") {
+                    port = value;
+                } else if (key == "name") {
+                    name = value;
+                }
+            }
+        }
+        configFile.close();
+    } else {
+        cerr << "Unable to open configfile.txt" << endl;
+        return 1;
+    }
+
+    if (address.empty() || port.empty() || name.empty()) {
+        cerr << "Missing required configuration parameters in configfile.txt" << endl;
+        cerr << "Required parameters: address, port, name" << endl;
+        return 1;
+    }
+
+    Ice::CommunicatorPtr ic;
+    shared_ptr <MPKPrx> mpk;
+    shared_ptr <LineFactoryPrx> lineFactoryPrx;
+    shared_ptr <StopFactoryPrx> stopFactoryPrx;
+    try {
+        ic = initializeWithThreadPool(argc, argv);
+        auto base = ic->stringToProxy(name + ":default -h " + address + " -p " + port + " -t 8000");
+        mpk = Ice::checkedCast<MPKPrx>(base);
+        if (!mpk) {
+            throw "Invalid proxy";
+        }
+
+        Ice::ObjectAdapterPtr adapter = ic->createObjectAdapterWithEndpoints("FactoryAdapter",
+                                                                             "default -p " + factoryPort);
+
+        //zwarte id przystankow i tramwajow nadaje MPK
+        auto ids = make_shared<IdDirectory>(mpk);
+        //obraz sieci prowadzi MPK i dopisuje linie przy createLine; zdalna linia nie ma lokalnej kopii,
+        //ktorej nikt by nie czytal - jej tramwaje sa widoczne przez Line::getTrams
+        auto lineFactory = make_shared<LineFactoryI>(adapter, nullptr, ids);
+        lineFactoryPrx = Ice::uncheckedCast<LineFactoryPrx>(adapter->addWithUUID(make_shared<TimedServant>(lineFactory)));
+        size_t residentStops = ic->getProperties()->getPropertyAsIntWithDefault("MPK.ResidentStops", 1000);
+        auto notifier = make_shared<NotificationEngine>();
+        auto stopFactory = make_shared<StopFactoryI>(adapter, notifier, ids, residentStops);
+        stopFactoryPrx = Ice::uncheckedCast<StopFactoryPrx>(adapter->addWithUUID(make_shared<TimedServant>(stopFactory)));
+        auto metrics = make_shared<MetricsAdminI>(notifier);
+        ic->addAdminFacet(metrics, "MPK.Metrics");
+        adapter->activate();
+
+        mpk->registerLineFactory(lineFactoryPrx);
+        if (shard) {
+            mpk->registerStopShard(stopFactoryPrx);
+        } else {
+            mpk->registerStopFactory(stopFactoryPrx);
+        }
+        cout << "Fabryki zarejestrowane w MPK. Kliknij l - aby wyswietlic obciazenie, m - metryki, "
+             << "t - zapis sladu przyjazdow, q - aby zakonczyc"
+             << endl;
+
+        while (true) {
+            char sign;
+            cin >> sign;
+            if (!cin || sign == 'q') {
+                break;
+            }
+            if (sign == 'm') {
+                printMetrics(cout, metrics->getMetrics());
+                continue;
+            }
+            if (sign == 't') {
+                string traceFile = traceFilePath(ic->getProperties());
+                cout << (tracer().dump(traceFile) ? "Slad zapisany w " : "Nie mozna zapisac ") << traceFile << endl;
+                continue;
+            }
+            cout << "Obciazenie: linie " << lineFactory->getLoad() << ", przystanki "
+                 << stopFactory->getLoad() << endl;
+        }
+
+        mpk->unregisterLineFactory(lineFactoryPrx);
+        if (shard) {
+            //MPK odtwarza przystanki tego shardu u pozostalych, zanim proces sie zakonczy
+            mpk->unregisterStopShard(stopFactoryPrx);
+        } else {
+            mpk->unregisterStopFactory(stopFactoryPrx);
+        }
+    }
+    catch (const Ice::Exception &e) {
+        cout << e << endl;
+    } catch (const char *msg) {
+        cout << msg << endl;
+    }
+
+    if (ic) {
+        try {
+            ic->destroy();
+        } catch (const Ice::Exception &e) {
+            cout << e << endl;
+        }
+    }
+
+    cout << "Koniec pracy fabryki" << endl;
+}
@@ -0,0 +1,90 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// Histogram w stylu HDR: kubelki sa potegami dwojki podzielonymi na 8 rownych czesci, wiec
+// percentyl jest obarczony bledem co najwyzej 12.5%, a pamiec nie zalezy od zakresu wartosci.
+// Zapis to kilka atomowych operacji bez blokad.
+class Histogram {
+private:
+    static const int subBuckets = 8;
+    static const int bucketsCount = 62 * subBuckets;
+
+    array<atomic<uint64_t>, bucketsCount> counts;
+    atomic<uint64_t> total{0};
+    atomic<uint64_t> maximum{0};
+
+    static int index(uint64_t value) {
+        if (value < subBuckets) {
+            return static_cast<int>(value);
+        }
+        int highestBit = 63 - __builtin_clzll(value);
+        int sub = static_cast<int>((value >> (highestBit - 3)) & (subBuckets - 1));
+        return (highestBit - 2) * subBuckets + sub;
+    }
+
+    static uint64_t lowerBound(int index) {
+        if (index < subBuckets) {
+            return static_cast<uint64_t>(index);
+        }
+        int highestBit = index / subBuckets + 2;
+        return static_cast<uint64_t>(subBuckets + index % subBuckets) << (highestBit - 3);
+    }
+
+public:
+    Histogram() {
+        reset();
+    }
+
+    void record(uint64_t value) {
+        counts[index(value)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        uint64_t seen = maximum.load(memory_order_relaxed);
+        while (value > seen && !maximum.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const {
+        return total.load(memory_order_relaxed);
+    }
+
+    uint64_t max() const {
+        return maximum.load(memory_order_relaxed);
+    }
+
+    // gorna granica kubelka, w ktorym wypada percentyl `fraction` (0..1)
+    uint64_t percentile(double fraction) const {
+        uint64_t all = count();
+        if (all == 0) {
+            return 0;
+        }
+        uint64_t wanted = static_cast<uint64_t>(fraction * all);
+        if (wanted == 0) {
+            wanted = 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < bucketsCount; ++i) {
+            seen += counts[i].load(memory_order_relaxed);
+            if (seen >= wanted) {
+                uint64_t upper = i + 1 < bucketsCount ? lowerBound(i + 1) - 1 : lowerBound(i);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+    void reset() {
+        for (auto &bucket: counts) {
+            bucket.store(0, memory_order_relaxed);
+        }
+        total = 0;
+        maximum = 0;
+    }
+};
+
+#endif
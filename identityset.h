@@ -0,0 +1,111 @@
+#ifndef IDENTITYSET_H
+#define IDENTITYSET_H
+
+#include <Ice/Ice.h>
+#include "MPK.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace SIP;
+
+struct IdentityHash {
+    size_t operator()(const Ice::Identity &identity) const {
+        size_t seed = hash<string>()(identity.name);
+        return seed ^ (hash<string>()(identity.category) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+    }
+};
+
+template<typename Prx>
+inline Ice::Identity identityOf(const shared_ptr <Prx> &prx) {
+    return prx->ice_getIdentity();
+}
+
+inline Ice::Identity identityOf(const TramInfo &tramInfo) {
+    return tramInfo.tram->ice_getIdentity();
+}
+
+// Zbior obiektow (proxy albo TramInfo) wedlug tozsamosci Ice. Elementy leza ciasno w wektorze,
+// wiec kopia listy do rozeslania to jedno kopiowanie tablicy, a indeks tozsamosc -> pozycja
+// daje dodanie i usuniecie w O(1): usuwany element zastepuje ostatni. Kolejnosc nie jest
+// zachowywana. Bez wlasnej blokady - chroni go blokada servanta.
+template<typename T>
+class IdentitySet {
+private:
+    vector <T> members;
+    unordered_map <Ice::Identity, size_t, IdentityHash> positions;
+
+public:
+    IdentitySet() = default;
+
+    explicit IdentitySet(vector <T> initial) {
+        for (auto &member: initial) {
+            add(move(member));
+        }
+    }
+
+    // Ponowne dodanie tego samego obiektu tylko odswieza wpis (np. proxy pasazera, ktory
+    // polaczyl sie od nowa); zwraca false, gdy obiekt juz byl w zbiorze.
+    bool add(T member) {
+        auto inserted = positions.emplace(identityOf(member), members.size());
+        if (!inserted.second) {
+            members[inserted.first->second] = move(member);
+            return false;
+        }
+        members.push_back(move(member));
+        return true;
+    }
+
+    // false, gdy obiektu nie bylo
+    bool remove(const Ice::Identity &identity) {
+        auto found = positions.find(identity);
+        if (found == positions.end()) {
+            return false;
+        }
+        size_t position = found->second;
+        positions.erase(found);
+        if (position + 1 != members.size()) {
+            members[position] = move(members.back());
+            positions[identityOf(members[position])] = position;
+        }
+        members.pop_back();
+        return true;
+    }
+
+    template<typename Predicate>
+    size_t removeIf(Predicate predicate) {
+        size_t removed = 0;
+        for (size_t position = 0; position < members.size();) {
+            if (predicate(members[position])) {
+                // na to miejsce trafia ostatni element, wiec pozycja sie nie zmienia
+                remove(identityOf(members[position]));
+                removed++;
+            } else {
+                position++;
+            }
+        }
+        return removed;
+    }
+
+    bool contains(const Ice::Identity &identity) const {
+        return positions.count(identity) > 0;
+    }
+
+    const vector <T> &all() const {
+        return members;
+    }
+
+    size_t size() const {
+        return members.size();
+    }
+
+    bool empty() const {
+        return members.empty();
+    }
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef IDS_H
+#define IDS_H
+
+#include <Ice/Ice.h>
+#include "MPK.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+using namespace SIP;
+
+// Zwarte id przystankow i tramwajow nadawane przez MPK (te same, co w NetworkSnapshot).
+// Kazdy proces pamieta raz poznane id, wiec zdalne pytanie o dany obiekt pada tylko raz.
+// Tak samo pamietane sa niezmienne metadane: numery taborowe tramwajow i nazwy przystankow.
+class IdDirectory {
+private:
+    function<int(const shared_ptr <TramStopPrx> &)> resolveStop;
+    function<int(const shared_ptr <TramPrx> &)> resolveTram;
+    mutex idsMutex;
+    unordered_map <string, int> stopIds;
+    unordered_map <string, int> tramIds;
+    unordered_map <string, string> stockNumbers;
+    unordered_map <string, string> stopNames;
+
+    template<typename Value, typename Prx, typename Resolve>
+    Value lookup(unordered_map <string, Value> &ids, const shared_ptr <Prx> &prx, const Resolve &resolve) {
+        string key = Ice::identityToString(prx->ice_getIdentity());
+        {
+            lock_guard <mutex> lock(idsMutex);
+            auto found = ids.find(key);
+            if (found != ids.end()) {
+                return found->second;
+            }
+        }
+        // wywolanie poza blokada; dwa rownolegle pytania o ten sam obiekt dadza to samo id
+        Value id = resolve(prx);
+        lock_guard <mutex> lock(idsMutex);
+        ids[key] = id;
+        return id;
+    }
+
+public:
+    IdDirectory(function<int(const shared_ptr <TramStopPrx> &)> resolveStop,
+                function<int(const shared_ptr <TramPrx> &)> resolveTram)
+            : resolveStop(resolveStop), resolveTram(resolveTram) {}
+
+    // dla procesow poza systemem - id nadaje zdalne MPK
+    explicit IdDirectory(shared_ptr <MPKPrx> mpk)
+            : resolveStop([mpk](const shared_ptr <TramStopPrx> &stop) { return mpk->getStopId(stop); }),
+              resolveTram([mpk](const shared_ptr <TramPrx> &tram) { return mpk->getTramId(tram); }) {}
+
+    int stopId(const shared_ptr <TramStopPrx> &stop) {
+        return lookup(stopIds, stop, resolveStop);
+    }
+
+    int tramId(const shared_ptr <TramPrx> &tram) {
+        return lookup(tramIds, tram, resolveTram);
+    }
+
+    // zdalne getStockNumber tylko przy pierwszym spotkaniu tramwaju; blad nie jest zapamietywany
+    string stockNumber(const shared_ptr <TramPrx> &tram) {
+        return lookup(stockNumbers, tram, [](const shared_ptr <TramPrx> &prx) { return prx->getStockNumber(); });
+    }
+
+    string stopName(const shared_ptr <TramStopPrx> &stop) {
+        return lookup(stopNames, stop, [](const shared_ptr <TramStopPrx> &prx) { return prx->getName(); });
+    }
+};
+
+// minuta doby - zwarty zapis Time w listach id
+inline short minuteOfDay(const Time &time) {
+    return static_cast<short>(time.hour * 60 + time.minute);
+}
+
+#endif
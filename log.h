@@ -0,0 +1,53 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+// Poziomy logow: error - tylko bledy, info - zdarzenia systemu (domyslnie), debug - kazde
+// wywolanie na goracej sciezce (subskrypcje, przyjazdy). Poziom ustawia --MPK.LogLevel.
+enum class LogLevel : int {
+    Error = 0,
+    Info = 1,
+    Debug = 2
+};
+
+inline std::atomic<int> &currentLogLevel() {
+    static std::atomic<int> level{static_cast<int>(LogLevel::Info)};
+    return level;
+}
+
+inline std::mutex &logMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+inline bool logEnabled(LogLevel level) {
+    return static_cast<int>(level) <= currentLogLevel().load(std::memory_order_relaxed);
+}
+
+// przyjmuje nazwe poziomu albo jego numer; nieznana nazwa zostawia poziom bez zmian
+inline void setLogLevel(const std::string &name) {
+    if (name == "error" || name == "0") {
+        currentLogLevel() = static_cast<int>(LogLevel::Error);
+    } else if (name == "info" || name == "1") {
+        currentLogLevel() = static_cast<int>(LogLevel::Info);
+    } else if (name == "debug" || name == "2") {
+        currentLogLevel() = static_cast<int>(LogLevel::Debug);
+    }
+}
+
+// Komunikat jest skladany dopiero, gdy poziom jest wlaczony, wiec wylaczony log kosztuje
+// jedno porownanie. Wiersze z roznych watkow sie nie przeplataja.
+#define MPK_LOG(level, message)                                   \
+    do {                                                          \
+        if (logEnabled(level)) {                                  \
+            std::lock_guard <std::mutex> logLock(logMutex());     \
+            std::cout << message << std::endl;                    \
+        }                                                         \
+    } while (false)
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Ice/Ice.h>
+#include "MPK.h"
+#include "notifier.h"
+#include "histogram.h"
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+
+using namespace std;
+using namespace SIP;
+
+// Czasy wywolan kazdej operacji z mpk.ice w tym procesie (interfejs -> operacja -> histogram).
+// Histogramy powstaja przy pierwszym wywolaniu danej operacji i nigdy nie sa usuwane, wiec
+// odczyt po rozgrzaniu bierze tylko blokade wspoldzielona.
+class OperationMetrics {
+private:
+    shared_timed_mutex metricsMutex;
+    map <string, map<string, unique_ptr<Histogram>>> histograms;
+
+public:
+    Histogram &histogram(const string &interfaceName, const string &operation) {
+        {
+            shared_lock <shared_timed_mutex> lock(metricsMutex);
+            auto byInterface = histograms.find(interfaceName);
+            if (byInterface != histograms.end()) {
+                auto found = byInterface->second.find(operation);
+                if (found != byInterface->second.end()) {
+                    return *found->second;
+                }
+            }
+        }
+        unique_lock <shared_timed_mutex> lock(metricsMutex);
+        auto &created = histograms[interfaceName][operation];
+        if (!created) {
+            created.reset(new Histogram());
+        }
+        return *created;
+    }
+
+    // czasy w mikrosekundach
+    OperationStatsList report() {
+        shared_lock <shared_timed_mutex> lock(metricsMutex);
+        OperationStatsList operations;
+        for (const auto &byInterface: histograms) {
+            for (const auto &operation: byInterface.second) {
+                OperationStats stats;
+                stats.name = byInterface.first + "." + operation.first;
+                stats.count = static_cast<Ice::Long>(operation.second->count());
+                stats.p50 = static_cast<Ice::Long>(operation.second->percentile(0.5) / 1000);
+                stats.p99 = static_cast<Ice::Long>(operation.second->percentile(0.99) / 1000);
+                stats.max = static_cast<Ice::Long>(operation.second->max() / 1000);
+                operations.push_back(stats);
+            }
+        }
+        return operations;
+    }
+
+    void reset() {
+        shared_lock <shared_timed_mutex> lock(metricsMutex);
+        for (const auto &byInterface: histograms) {
+            for (const auto &operation: byInterface.second) {
+                operation.second->reset();
+            }
+        }
+    }
+};
+
+inline OperationMetrics &operationMetrics() {
+    static OperationMetrics metrics;
+    return metrics;
+}
+
+// Przepuszcza kazde wywolanie do servanta i zapisuje jego czas w OperationMetrics.
+class TimedServant : public Ice::DispatchInterceptor {
+private:
+    shared_ptr <Ice::Object> servant;
+    string interfaceName;
+
+    struct Timer {
+        Histogram &histogram;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        ~Timer() {
+            histogram.record(static_cast<uint64_t>(
+                                     chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()));
+        }
+    };
+
+public:
+    explicit TimedServant(shared_ptr <Ice::Object> servant) : servant(servant) {
+        // "::SIP::TramStop" -> "TramStop"
+        interfaceName = servant->ice_id(Ice::Current());
+        size_t separator = interfaceName.rfind("::");
+        if (separator != string::npos) {
+            interfaceName = interfaceName.substr(separator + 2);
+        }
+    }
+
+    bool dispatch(Ice::Request &request) override {
+        // czas jest zapisywany takze wtedy, gdy operacja konczy sie wyjatkiem
+        Timer timer{operationMetrics().histogram(interfaceName, request.getCurrent().operation)};
+        return servant->ice_dispatch(request);
+    }
+};
+
+// Facet administracyjny "MPK.Metrics" (wlaczany przez --Ice.Admin.Endpoints) i zrodlo
+// polecenia 'm' w konsoli systemu.
+class MetricsAdminI : public SIP::MetricsAdmin {
+private:
+    shared_ptr <NotificationEngine> notifier;
+public:
+    explicit MetricsAdminI(shared_ptr <NotificationEngine> notifier) : notifier(notifier) {}
+
+    MetricsReport getMetrics(const Ice::Current &current = Ice::Current()) override {
+        MetricsReport report;
+        report.operations = operationMetrics().report();
+        report.notificationQueue = 0;
+        report.fanOut.name = "fanOut";
+        report.fanOut.count = report.fanOut.p50 = report.fanOut.p99 = report.fanOut.max = 0;
+        report.delivered = report.dropped = report.dead = 0;
+        if (notifier) {
+            NotificationEngine::Stats stats = notifier->getStats();
+            Histogram &fanOut = notifier->getFanOut();
+            report.notificationQueue = notifier->queueDepth();
+            report.fanOut.count = static_cast<Ice::Long>(fanOut.count());
+            report.fanOut.p50 = static_cast<Ice::Long>(fanOut.percentile(0.5));
+            report.fanOut.p99 = static_cast<Ice::Long>(fanOut.percentile(0.99));
+            report.fanOut.max = static_cast<Ice::Long>(fanOut.max());
+            report.delivered = stats.delivered;
+            report.dropped = stats.dropped;
+            report.dead = stats.dead;
+        }
+        // czas od przyjazdu tramwaju do dostarczenia powiadomienia, dla kazdego przystanku
+        tracer().visitLatencies([&report](const string &stop, const Histogram &latency) {
+            OperationStats stats;
+            stats.name = stop;
+            stats.count = static_cast<Ice::Long>(latency.count());
+            stats.p50 = static_cast<Ice::Long>(latency.percentile(0.5));
+            stats.p99 = static_cast<Ice::Long>(latency.percentile(0.99));
+            stats.max = static_cast<Ice::Long>(latency.max());
+            report.arrivalLatency.push_back(stats);
+        });
+        return report;
+    }
+
+    void resetMetrics(const Ice::Current &current = Ice::Current()) override {
+        operationMetrics().reset();
+        tracer().resetLatencies();
+        if (notifier) {
+            notifier->getFanOut().reset();
+        }
+    }
+};
+
+inline void printMetrics(ostream &out, const MetricsReport &report) {
+    out << left << setw(36) << "operacja" << right << setw(12) << "wywolania" << setw(10) << "p50 us"
+        << setw(10) << "p99 us" << setw(10) << "max us" << endl;
+    for (const auto &operation: report.operations) {
+        out << left << setw(36) << operation.name << right << setw(12) << operation.count << setw(10)
+            << operation.p50 << setw(10) << operation.p99 << setw(10) << operation.max << endl;
+    }
+    out << "Kolejka powiadomien: " << report.notificationQueue << endl;
+    out << "Odbiorcy na powiadomienie: p50 " << report.fanOut.p50 << ", p99 " << report.fanOut.p99
+        << ", max " << report.fanOut.max << " (" << report.fanOut.count << " powiadomien)" << endl;
+    out << "Dostarczone: " << report.delivered << ", odrzucone: " << report.dropped
+        << ", martwi pasazerowie: " << report.dead << endl;
+    if (!report.arrivalLatency.empty()) {
+        out << left << setw(36) << "przyjazd -> pasazer" << right << setw(12) << "powiadomienia" << setw(10)
+            << "p50 us" << setw(10) << "p99 us" << setw(10) << "max us" << endl;
+        for (const auto &stop: report.arrivalLatency) {
+            out << left << setw(36) << stop.name << right << setw(12) << stop.count << setw(10)
+                << stop.p50 << setw(10) << stop.p99 << setw(10) << stop.max << endl;
+        }
+    }
+}
+
+#endif
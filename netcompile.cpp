@@ -0,0 +1,26 @@
+#include "netfile.h"
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// Kompiluje stops.txt i lines.txt do obrazu network.bin wczytywanego przez system przy starcie.
+int main(int argc, char *argv[]) {
+    string stopsPath = argc > 1 ? argv[1] : "stops.txt";
+    string linesPath = argc > 2 ? argv[2] : "lines.txt";
+    string outputPath = argc > 3 ? argv[3] : "network.bin";
+
+    if (!netfile::compile(stopsPath, linesPath, outputPath)) {
+        cerr << "Nie można skompilować sieci z " << stopsPath << " i " << linesPath << endl;
+        return 1;
+    }
+
+    netfile::Image image(outputPath);
+    if (!image.valid()) {
+        cerr << "Zapisany obraz jest niepoprawny: " << image.getError() << endl;
+        return 1;
+    }
+    cout << "Zapisano " << outputPath << ": przystanki " << image.stopsCount()
+         << ", linie " << image.linesCount() << endl;
+    return 0;
+}
@@ -0,0 +1,328 @@
+#ifndef NETFILE_H
+#define NETFILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Skompilowany obraz sieci (network.bin) budowany z stops.txt i lines.txt.
+// Uklad pliku (liczby little-endian, wszystkie pola 32-bitowe poza suma kontrolna i odciskiem):
+//   naglowek   magic "MPKN", wersja, liczba przystankow, liczba linii, liczba indeksow,
+//              rozmiar puli nazw, suma kontrolna FNV-1a (64 bity) wszystkiego za naglowkiem,
+//              odcisk plikow zrodlowych (64 bity, z rozmiarow i czasow modyfikacji)
+//   przystanki {offset nazwy, dlugosc nazwy} dla kazdego przystanku
+//   linie      {offset nazwy, dlugosc nazwy, pierwszy indeks, liczba przystankow}
+//   indeksy    numery przystankow kolejnych linii
+//   pula nazw  kazda nazwa zapisana raz, bez terminatorow
+// Plik jest mapowany w pamieci i czytany bez kopiowania i bez parsowania.
+namespace netfile {
+
+    const uint32_t magic = 0x4e4b504d; // "MPKN"
+    const uint32_t formatVersion = 2;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t stopsCount;
+        uint32_t linesCount;
+        uint32_t indicesCount;
+        uint32_t namesSize;
+        uint64_t checksum;
+        uint64_t sources;
+    };
+
+    struct Name {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Line {
+        Name name;
+        uint32_t firstIndex;
+        uint32_t stopsCount;
+    };
+
+    inline uint64_t checksum(const char *data, size_t size) {
+        uint64_t value = 14695981039346656037ull;
+        for (size_t i = 0; i < size; ++i) {
+            value ^= static_cast<unsigned char>(data[i]);
+            value *= 1099511628211ull;
+        }
+        return value;
+    }
+
+    // Odcisk stops.txt i lines.txt zapisany w obrazie; obraz z innym odciskiem jest nieaktualny.
+    // Zwraca false, gdy ktoregos z plikow nie ma.
+    inline bool sourcesFingerprint(const std::string &stopsPath, const std::string &linesPath, uint64_t &fingerprint) {
+        std::string sources;
+        for (const std::string &path: {stopsPath, linesPath}) {
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0) {
+                return false;
+            }
+            int64_t fields[] = {static_cast<int64_t>(info.st_size), static_cast<int64_t>(info.st_mtim.tv_sec),
+                                static_cast<int64_t>(info.st_mtim.tv_nsec)};
+            sources.append(reinterpret_cast<const char *>(fields), sizeof(fields));
+        }
+        fingerprint = checksum(sources.data(), sources.size());
+        return true;
+    }
+
+    struct TextLine {
+        std::string name;
+        std::vector <std::string> stops;
+    };
+
+    struct TextNetwork {
+        std::vector <std::string> stops;
+        std::vector <TextLine> lines;
+    };
+
+    // Jedyny parser plikow tekstowych - uzywa go kompilator obrazu i system, gdy obrazu nie ma.
+    // Przystanki sa rozdzielone bialymi znakami, linia to "nazwa: przystanek przystanek ...";
+    // wiersze bez ':' sa pomijane, a koncowe '\r' z plikow z Windows usuwane. Zwraca false,
+    // gdy nie da sie otworzyc ktoregos z plikow.
+    inline bool parse(const std::string &stopsPath, const std::string &linesPath, TextNetwork &network) {
+        std::ifstream stopsFile(stopsPath);
+        std::ifstream linesFile(linesPath);
+        if (!stopsFile.is_open() || !linesFile.is_open()) {
+            return false;
+        }
+
+        std::string stopName;
+        while (stopsFile >> stopName) {
+            network.stops.push_back(stopName);
+        }
+
+        std::string fileLine;
+        while (getline(linesFile, fileLine)) {
+            if (!fileLine.empty() && fileLine.back() == '\r') {
+                fileLine.pop_back();
+            }
+            size_t separator = fileLine.find(':');
+            if (separator == std::string::npos) {
+                continue;
+            }
+            TextLine line;
+            line.name = fileLine.substr(0, separator);
+            std::istringstream iss(fileLine.substr(separator + 1));
+            while (iss >> stopName) {
+                line.stops.push_back(stopName);
+            }
+            network.lines.push_back(line);
+        }
+        return true;
+    }
+
+    // Czyta pliki tekstowe w formacie systemu i zapisuje obraz. Zwraca false, gdy nie da sie
+    // otworzyc ktoregos z plikow.
+    inline bool compile(const std::string &stopsPath, const std::string &linesPath, const std::string &outputPath) {
+        uint64_t sources;
+        TextNetwork network;
+        if (!sourcesFingerprint(stopsPath, linesPath, sources) || !parse(stopsPath, linesPath, network)) {
+            return false;
+        }
+
+        std::string names;
+        std::unordered_map <std::string, uint32_t> stopIds;
+        std::vector <Name> stops;
+        std::vector <Line> lines;
+        std::vector <uint32_t> indices;
+
+        auto intern = [&](const std::string &name) {
+            Name entry;
+            entry.offset = static_cast<uint32_t>(names.size());
+            entry.length = static_cast<uint32_t>(name.size());
+            names += name;
+            return entry;
+        };
+        auto stopId = [&](const std::string &name) {
+            auto found = stopIds.find(name);
+            if (found != stopIds.end()) {
+                return found->second;
+            }
+            uint32_t id = static_cast<uint32_t>(stops.size());
+            stops.push_back(intern(name));
+            stopIds[name] = id;
+            return id;
+        };
+
+        for (const auto &stopName: network.stops) {
+            stopId(stopName);
+        }
+        for (const auto &textLine: network.lines) {
+            Line line;
+            line.name = intern(textLine.name);
+            line.firstIndex = static_cast<uint32_t>(indices.size());
+            for (const auto &stopName: textLine.stops) {
+                indices.push_back(stopId(stopName));
+            }
+            line.stopsCount = static_cast<uint32_t>(indices.size()) - line.firstIndex;
+            lines.push_back(line);
+        }
+
+        std::string body;
+        body.append(reinterpret_cast<const char *>(stops.data()), stops.size() * sizeof(Name));
+        body.append(reinterpret_cast<const char *>(lines.data()), lines.size() * sizeof(Line));
+        body.append(reinterpret_cast<const char *>(indices.data()), indices.size() * sizeof(uint32_t));
+        body += names;
+
+        Header header;
+        header.magic = magic;
+        header.version = formatVersion;
+        header.stopsCount = static_cast<uint32_t>(stops.size());
+        header.linesCount = static_cast<uint32_t>(lines.size());
+        header.indicesCount = static_cast<uint32_t>(indices.size());
+        header.namesSize = static_cast<uint32_t>(names.size());
+        header.checksum = checksum(body.data(), body.size());
+        header.sources = sources;
+
+        std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        output.write(body.data(), body.size());
+        return static_cast<bool>(output);
+    }
+
+    // Obraz zmapowany w pamieci. Gdy plik nie istnieje albo jest uszkodzony, valid() zwraca false
+    // i system wraca do plikow tekstowych.
+    class Image {
+    private:
+        void *memory = MAP_FAILED;
+        size_t size = 0;
+        const Header *header = nullptr;
+        const Name *stops = nullptr;
+        const Line *lines = nullptr;
+        const uint32_t *indices = nullptr;
+        const char *names = nullptr;
+        std::string error;
+
+        bool check() {
+            if (size < sizeof(Header)) {
+                error = "plik za krotki";
+                return false;
+            }
+            header = static_cast<const Header *>(memory);
+            if (header->magic != magic || header->version != formatVersion) {
+                error = "nieznany format";
+                return false;
+            }
+            uint64_t expected = sizeof(Header)
+                                + uint64_t(header->stopsCount) * sizeof(Name)
+                                + uint64_t(header->linesCount) * sizeof(Line)
+                                + uint64_t(header->indicesCount) * sizeof(uint32_t)
+                                + header->namesSize;
+            if (expected != size) {
+                error = "niezgodny rozmiar";
+                return false;
+            }
+            const char *body = static_cast<const char *>(memory) + sizeof(Header);
+            if (checksum(body, size - sizeof(Header)) != header->checksum) {
+                error = "bledna suma kontrolna";
+                return false;
+            }
+            stops = reinterpret_cast<const Name *>(body);
+            lines = reinterpret_cast<const Line *>(stops + header->stopsCount);
+            indices = reinterpret_cast<const uint32_t *>(lines + header->linesCount);
+            names = reinterpret_cast<const char *>(indices + header->indicesCount);
+            for (uint32_t i = 0; i < header->stopsCount; ++i) {
+                if (uint64_t(stops[i].offset) + stops[i].length > header->namesSize) {
+                    error = "bledna nazwa przystanku";
+                    return false;
+                }
+            }
+            for (uint32_t i = 0; i < header->linesCount; ++i) {
+                if (uint64_t(lines[i].name.offset) + lines[i].name.length > header->namesSize
+                    || uint64_t(lines[i].firstIndex) + lines[i].stopsCount > header->indicesCount) {
+                    error = "bledna linia";
+                    return false;
+                }
+            }
+            for (uint32_t i = 0; i < header->indicesCount; ++i) {
+                if (indices[i] >= header->stopsCount) {
+                    error = "bledny indeks przystanku";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    public:
+        explicit Image(const std::string &path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd == -1) {
+                error = "brak pliku";
+                return;
+            }
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                size = static_cast<size_t>(info.st_size);
+                memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            close(fd);
+            if (memory == MAP_FAILED) {
+                error = "nie mozna zmapowac pliku";
+                return;
+            }
+            if (!check()) {
+                header = nullptr;
+            }
+        }
+
+        ~Image() {
+            if (memory != MAP_FAILED) {
+                munmap(memory, size);
+            }
+        }
+
+        Image(const Image &) = delete;
+
+        Image &operator=(const Image &) = delete;
+
+        bool valid() const {
+            return header != nullptr;
+        }
+
+        const std::string &getError() const {
+            return error;
+        }
+
+        uint64_t sources() const {
+            return header->sources;
+        }
+
+        uint32_t stopsCount() const {
+            return header->stopsCount;
+        }
+
+        uint32_t linesCount() const {
+            return header->linesCount;
+        }
+
+        std::string stopName(uint32_t stop) const {
+            return std::string(names + stops[stop].offset, stops[stop].length);
+        }
+
+        std::string lineName(uint32_t line) const {
+            return std::string(names + lines[line].name.offset, lines[line].name.length);
+        }
+
+        uint32_t lineStopsCount(uint32_t line) const {
+            return lines[line].stopsCount;
+        }
+
+        // indeksy przystankow linii, wskazuja bezposrednio w zmapowany plik
+        const uint32_t *lineStops(uint32_t line) const {
+            return indices + lines[line].firstIndex;
+        }
+    };
+}
+
+#endif
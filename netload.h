@@ -0,0 +1,136 @@
+#ifndef NETLOAD_H
+#define NETLOAD_H
+
+#include <Ice/Ice.h>
+#include "system.h"
+#include "netfile.h"
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace SIP;
+
+// Wczytywanie sieci przystankow i linii do MPK - wspolne dla ./system i ./collocated.
+
+// Wczytuje siec ze skompilowanego obrazu: przystanki tworzone sa raz, w kolejnosci obrazu,
+// a linie dostaja je po indeksach, bez wyszukiwania po nazwach. Zwraca false, gdy obrazu
+// nie ma, jest uszkodzony albo zostal zbudowany z innych wersji plikow tekstowych.
+inline bool loadNetworkImage(MPK_I &mpk, string path, string stopsPath, string linesPath) {
+    auto start = chrono::steady_clock::now();
+    netfile::Image image(path);
+    if (!image.valid()) {
+        cout << "Brak obrazu sieci " << path << " (" << image.getError() << "), wczytuje pliki tekstowe" << endl;
+        return false;
+    }
+    // bez plikow tekstowych nie ma z czym porownac - zostaje obraz
+    uint64_t sources;
+    if (netfile::sourcesFingerprint(stopsPath, linesPath, sources) && sources != image.sources()) {
+        cout << "Obraz sieci " << path << " nie odpowiada plikom " << stopsPath << " i " << linesPath
+             << ", wczytuje pliki tekstowe" << endl;
+        return false;
+    }
+
+    // jedno wywolanie createStops na fabryke zamiast osobnego na kazdy przystanek
+    vector <string> stopNames;
+    stopNames.reserve(image.stopsCount());
+    for (uint32_t i = 0; i < image.stopsCount(); ++i) {
+        stopNames.push_back(image.stopName(i));
+    }
+    vector <shared_ptr<TramStopPrx>> stops = mpk.placeStops(stopNames);
+
+    time_t currentTime;
+    time(&currentTime);
+    tm *timeNow = localtime(&currentTime);
+
+    cout << "Dostepne linie i przystanki: " << endl;
+    for (uint32_t i = 0; i < image.linesCount(); ++i) {
+        string line_number = image.lineName(i);
+        cout << "Linia nr: " << line_number << endl;
+        auto linePrx = mpk.placeLine(line_number);
+
+        StopList stopList;
+        const uint32_t *lineStops = image.lineStops(i);
+        cout << "\t przystanki: ";
+        for (uint32_t j = 0; j < image.lineStopsCount(i); ++j) {
+            StopInfo stopInfo;
+            stopInfo.time.hour = timeNow->tm_hour;
+            stopInfo.time.minute = timeNow->tm_min;
+            stopInfo.stop = stops[lineStops[j]];
+            stopList.push_back(stopInfo);
+            cout << image.stopName(lineStops[j]) << " ";
+        }
+        cout << endl;
+
+        if (linePrx != ICE_NULLPTR) {
+            linePrx->setStops(stopList);
+            mpk.addLine(linePrx, Ice::Current());
+        }
+    }
+    cout << "Siec wczytana z " << path << " w "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+    return true;
+}
+
+// Wczytuje siec z plikow tekstowych stops.txt i lines.txt tym samym parserem, ktorego uzywa ./netcompile.
+inline void loadNetworkFiles(MPK_I &mpk, string stopsPath, string linesPath) {
+    netfile::TextNetwork network;
+    if (!netfile::parse(stopsPath, linesPath, network)) {
+        cerr << "Nie można otworzyć pliku." << endl;
+        throw "File error";
+    }
+
+    //przystanki powstaja paczkami, po jednym wywolaniu na fabryke
+    mpk.placeStops(network.stops);
+
+    time_t currentTime;
+    time(&currentTime);
+    tm *timeNow = localtime(&currentTime);
+
+    cout << "Dostepne linie i przystanki: " << endl;
+    for (const auto &line: network.lines) {
+        cout << "Linia nr: " << line.name << endl;
+
+        //tworze obiekt linii
+        auto linePrx = mpk.placeLine(line.name);
+
+        //szukam przystankow i dodaje do linii
+        StopList stopList;
+        cout << "\t przystanki: ";
+        for (const auto &stop_name: line.stops) {
+            auto tramStopPrx = mpk.getTramStop(stop_name, Ice::Current());
+            if (!tramStopPrx) {
+                tramStopPrx = mpk.placeStop(stop_name);
+            }
+            StopInfo stopInfo;
+            stopInfo.time.hour = timeNow->tm_hour;
+            stopInfo.time.minute = timeNow->tm_min;
+            stopInfo.stop = tramStopPrx;
+            stopList.push_back(stopInfo);
+            if (!tramStopPrx) {
+                cout << "Brak przystankow";
+            } else {
+                cout << stop_name << " ";
+            }
+        }
+        cout << endl;
+
+        if (linePrx != ICE_NULLPTR) {
+            linePrx->setStops(stopList);
+            mpk.addLine(linePrx, Ice::Current());
+        }
+    }
+}
+
+// skompilowany obraz sieci (./netcompile) wczytuje sie bez parsowania tekstu
+inline void loadNetwork(MPK_I &mpk) {
+    if (!loadNetworkImage(mpk, "network.bin", "stops.txt", "lines.txt")) {
+        loadNetworkFiles(mpk, "stops.txt", "lines.txt");
+    }
+}
+
+#endif
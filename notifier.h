@@ -0,0 +1,555 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <Ice/Ice.h>
+#include "MPK.h"
+#include "histogram.h"
+#include "trace.h"
+#include "identityset.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace SIP;
+
+// Parametry operacji zakodowane raz w enkapsulacji Ice w kodowaniu odbiorcy. Te same bajty
+// trafiaja potem do wszystkich odbiorcow z tym kodowaniem przez ice_invoke.
+template<typename... Params>
+inline vector <Ice::Byte> encodeParams(const Ice::CommunicatorPtr &communicator, const Ice::EncodingVersion &encoding,
+                                       const Params &... params) {
+    Ice::OutputStream out(communicator, encoding);
+    out.startEncapsulation(encoding, Ice::FormatType::DefaultFormat);
+    out.writeAll(params...);
+    out.endEncapsulation();
+    vector <Ice::Byte> encoded;
+    out.finished(encoded);
+    return encoded;
+}
+
+// Wysyla zakodowane parametry jako wywolanie `operation` (bez czekania na odpowiedz).
+inline void invokeEncoded(const shared_ptr <Ice::ObjectPrx> &target, const string &operation,
+                          const vector <Ice::Byte> &encoded,
+                          function<void(bool, pair<const Ice::Byte *, const Ice::Byte *>)> response,
+                          function<void(exception_ptr)> exception, const Ice::Context &context = Ice::noExplicitContext) {
+    target->ice_invokeAsync(operation, Ice::OperationMode::Normal,
+                            make_pair(encoded.data(), encoded.data() + encoded.size()),
+                            move(response), move(exception), nullptr, context);
+}
+
+// Servant trzymajacy liste pasazerow (przystanek, tramwaj). Silnik wola dropPassenger, gdy tylko
+// uzna pasazera za martwego, wiec martwi pasazerowie nie czekaja na kolejne powiadomienie.
+class PassengerOwner : public enable_shared_from_this<PassengerOwner> {
+public:
+    virtual ~PassengerOwner() = default;
+
+    // wolane poza blokadami silnika
+    virtual void dropPassenger(const Ice::Identity &passenger) = 0;
+};
+
+// Rozsyla powiadomienia do pasazerow z osobnych watkow przez AMI, wiec wywolanie servanta
+// nigdy nie czeka na pasazera. Kazdy pasazer ma wlasna ograniczona kolejke i co najwyzej
+// jedno wywolanie w locie; gdy nie nadaza, nowsze powiadomienie o tym samym kluczu
+// zastepuje starsze, a po przekroczeniu pojemnosci odrzucane sa najstarsze.
+// Powiadomienie jest kodowane raz przy publikacji, a kolejki wszystkich pasazerow
+// wspoldziela ten sam niezmienny komunikat - koszt pasazera to jedno ice_invoke.
+//
+// Silnik sledzi tez, czy pasazer zyje. Pasazer jest uznawany za martwego, gdy:
+// - zamknie sie jego polaczenie (pasazer wysyla heartbeaty, a ACM zamyka polaczenie,
+//   po ktorym nic nie przyszlo przez `livenessTimeout` sekund),
+// - nie da sie z nim polaczyc albo nie ma juz jego obiektu,
+// - kolejne `maxFailures` dostarczen z rzedu sie nie powiedzie.
+// Servanty zglaszaja swoich pasazerow (subscribed/unsubscribed) i dostaja dropPassenger od razu,
+// gdy pasazer umrze. Wpis o martwym pasazerze zyje tylko `deadRetention` - tyle, zeby nie
+// dostarczac powiadomien juz skopiowanych przez servanty; dropDead to tylko siatka asekuracyjna.
+class NotificationEngine : public enable_shared_from_this<NotificationEngine> {
+public:
+    struct Stats {
+        Ice::Long published;
+        Ice::Long delivered;
+        Ice::Long coalesced;
+        Ice::Long dropped;
+        Ice::Long failed;
+        Ice::Long dead;
+    };
+
+private:
+    struct Message {
+        string key;
+        // parametry notifyPassenger, osobno dla kazdego kodowania odbiorcow (zwykle jednego)
+        vector <pair<Ice::EncodingVersion, vector<Ice::Byte>>> encoded;
+        // sledzone zdarzenie przyjazdu i przystanek, na ktorym powstalo powiadomienie
+        TraceEvent trace;
+        Ice::Context context;
+        string stop;
+    };
+
+    struct Subscriber {
+        shared_ptr <PassengerPrx> passenger;
+        deque <shared_ptr<const Message>> pending;
+        bool inFlight = false;
+        bool watched = false;
+        int failures = 0;
+    };
+
+    static const int maxFailures = 3;
+
+    struct Broadcast {
+        vector <shared_ptr<PassengerPrx>> passengers;
+        shared_ptr<const Message> message;
+        Ice::Long publishedAt = 0;
+    };
+
+    size_t queueCapacity;
+    int livenessTimeout;
+    chrono::seconds deadRetention{30};
+    mutex queueMutex;
+    condition_variable broadcastReady;
+    deque <Broadcast> broadcasts;
+    unordered_map <Ice::Identity, shared_ptr<Subscriber>, IdentityHash> subscribers;
+    // martwi pasazerowie; wpis jest pamietany przez `deadRetention`
+    unordered_map <Ice::Identity, chrono::steady_clock::time_point, IdentityHash> deadPassengers;
+    // servanty, na ktorych listach jest dany pasazer
+    unordered_map <Ice::Identity, vector<weak_ptr<PassengerOwner>>, IdentityHash> owners;
+    // do powiadomienia poza blokada: servant i pasazer, ktorego ma usunac
+    using Orphans = vector <pair<weak_ptr<PassengerOwner>, Ice::Identity>>;
+    // pasazerowie obslugiwani przez dane polaczenie - wszyscy gina razem z nim
+    unordered_map <Ice::Connection *, vector<Ice::Identity>> passengersByConnection;
+    bool stopping = false;
+    vector <thread> workers;
+
+    atomic <Ice::Long> published{0};
+    atomic <Ice::Long> delivered{0};
+    atomic <Ice::Long> coalesced{0};
+    atomic <Ice::Long> dropped{0};
+    atomic <Ice::Long> failed{0};
+    atomic <Ice::Long> dead{0};
+    // liczba pasazerow na jedno powiadomienie
+    Histogram fanOut;
+
+    static Ice::Identity key(const shared_ptr <PassengerPrx> &passenger) {
+        return passenger->ice_getIdentity();
+    }
+
+    // wywolywane pod queueMutex
+    void enqueue(const shared_ptr <Subscriber> &subscriber, const shared_ptr<const Message> &message) {
+        for (auto &queued: subscriber->pending) {
+            if (!message->key.empty() && queued->key == message->key) {
+                queued = message;
+                coalesced++;
+                return;
+            }
+        }
+        if (subscriber->pending.size() >= queueCapacity) {
+            subscriber->pending.pop_front();
+            dropped++;
+        }
+        subscriber->pending.push_back(message);
+    }
+
+    static const vector <Ice::Byte> &encodedFor(const Message &message, const shared_ptr <PassengerPrx> &passenger) {
+        const Ice::EncodingVersion &encoding = passenger->ice_getEncodingVersion();
+        for (const auto &encoded: message.encoded) {
+            if (encoded.first == encoding) {
+                return encoded.second;
+            }
+        }
+        // publish koduje dla kazdego kodowania odbiorcow, wiec tu nie dochodzi
+        return message.encoded.front().second;
+    }
+
+    void send(const shared_ptr <Subscriber> &subscriber, const shared_ptr<const Message> &message) {
+        auto self = shared_from_this();
+        Ice::Long sentAt = message->trace.traced() ? nowMicros() : 0;
+        try {
+            invokeEncoded(
+                    subscriber->passenger, "notifyPassenger", encodedFor(*message, subscriber->passenger),
+                    [self, subscriber, message, sentAt](bool ok, pair<const Ice::Byte *, const Ice::Byte *>) {
+                        if (!ok) {
+                            // notifyPassenger nie deklaruje wyjatkow uzytkownika
+                            self->failed++;
+                            self->deliveryFailed(subscriber, make_exception_ptr(
+                                    Ice::UnknownUserException(__FILE__, __LINE__, "notifyPassenger")));
+                            self->completed(subscriber);
+                            return;
+                        }
+                        self->delivered++;
+                        tracer().delivered(message->trace, message->stop, sentAt);
+                        self->succeeded(subscriber);
+                        self->completed(subscriber);
+                    },
+                    [self, subscriber](exception_ptr error) {
+                        self->failed++;
+                        self->deliveryFailed(subscriber, error);
+                        self->completed(subscriber);
+                    },
+                    message->context);
+        } catch (const Ice::Exception &) {
+            failed++;
+            deliveryFailed(subscriber, current_exception());
+            completed(subscriber);
+        }
+    }
+
+    // po pierwszym udanym dostarczeniu polaczenie z pasazerem jest nadzorowane przez ACM
+    void succeeded(const shared_ptr <Subscriber> &subscriber) {
+        auto connection = subscriber->passenger->ice_getCachedConnection();
+        {
+            lock_guard <mutex> lock(queueMutex);
+            subscriber->failures = 0;
+            if (subscriber->watched || !connection) {
+                return;
+            }
+            subscriber->watched = true;
+            auto &watchedPassengers = passengersByConnection[connection.get()];
+            watchedPassengers.push_back(key(subscriber->passenger));
+            if (watchedPassengers.size() > 1) {
+                return;
+            }
+        }
+        // poza blokada - dla juz zamknietego polaczenia callback wola sie od razu
+        weak_ptr <NotificationEngine> weakSelf = shared_from_this();
+        try {
+            connection->setACM(livenessTimeout, Ice::ACMClose::CloseOnIdleForceful, Ice::ACMHeartbeat::HeartbeatOff);
+            connection->setCloseCallback([weakSelf](const shared_ptr <Ice::Connection> &closed) {
+                auto self = weakSelf.lock();
+                if (self) {
+                    self->connectionClosed(closed);
+                }
+            });
+        } catch (const Ice::Exception &) {
+            // polaczenie zamknelo sie w miedzyczasie
+            connectionClosed(connection);
+        }
+    }
+
+    void connectionClosed(const shared_ptr <Ice::Connection> &connection) {
+        try {
+            connection->throwException();
+        } catch (const Ice::ConnectionManuallyClosedException &) {
+            // zamkniecie po naszej stronie, pasazer moze zyc dalej
+            lock_guard <mutex> lock(queueMutex);
+            unwatch(connection.get());
+            return;
+        } catch (const Ice::CommunicatorDestroyedException &) {
+            return;
+        } catch (const Ice::Exception &) {
+        }
+        Orphans orphans;
+        {
+            lock_guard <mutex> lock(queueMutex);
+            auto found = passengersByConnection.find(connection.get());
+            if (found == passengersByConnection.end()) {
+                return;
+            }
+            for (const auto &passenger: found->second) {
+                markDead(passenger, orphans);
+            }
+            passengersByConnection.erase(found);
+        }
+        dropOrphans(orphans);
+    }
+
+    // wywolywane pod queueMutex
+    void unwatch(Ice::Connection *connection) {
+        auto found = passengersByConnection.find(connection);
+        if (found == passengersByConnection.end()) {
+            return;
+        }
+        for (const auto &passenger: found->second) {
+            auto subscriber = subscribers.find(passenger);
+            if (subscriber != subscribers.end()) {
+                subscriber->second->watched = false;
+            }
+        }
+        passengersByConnection.erase(found);
+    }
+
+    void deliveryFailed(const shared_ptr <Subscriber> &subscriber, exception_ptr error) {
+        bool fatal = false;
+        try {
+            rethrow_exception(error);
+        } catch (const Ice::ObjectNotExistException &) {
+            fatal = true;
+        } catch (const Ice::ConnectFailedException &) {
+            fatal = true;
+        } catch (...) {
+        }
+        Orphans orphans;
+        {
+            lock_guard <mutex> lock(queueMutex);
+            if (fatal || ++subscriber->failures >= maxFailures) {
+                markDead(key(subscriber->passenger), orphans);
+            }
+        }
+        dropOrphans(orphans);
+    }
+
+    void dropOrphans(const Orphans &orphans) {
+        for (const auto &orphan: orphans) {
+            auto owner = orphan.first.lock();
+            if (owner) {
+                owner->dropPassenger(orphan.second);
+            }
+        }
+    }
+
+    // wywolywane pod queueMutex; servanty do powiadomienia trafiaja do `orphans`
+    void markDead(const Ice::Identity &passenger, Orphans &orphans) {
+        auto now = chrono::steady_clock::now();
+        for (auto it = deadPassengers.begin(); it != deadPassengers.end();) {
+            if (now - it->second > deadRetention) {
+                it = deadPassengers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (deadPassengers.emplace(passenger, now).second) {
+            dead++;
+        }
+        auto subscriber = subscribers.find(passenger);
+        if (subscriber != subscribers.end()) {
+            dropped += subscriber->second->pending.size();
+            subscriber->second->pending.clear();
+            subscribers.erase(subscriber);
+        }
+        auto owned = owners.find(passenger);
+        if (owned != owners.end()) {
+            for (const auto &owner: owned->second) {
+                orphans.emplace_back(owner, passenger);
+            }
+            owners.erase(owned);
+        }
+    }
+
+    // wywolywane pod queueMutex; przeterminowany wpis jest od razu usuwany
+    bool isDeadLocked(const Ice::Identity &passenger) {
+        auto found = deadPassengers.find(passenger);
+        if (found == deadPassengers.end()) {
+            return false;
+        }
+        if (chrono::steady_clock::now() - found->second > deadRetention) {
+            deadPassengers.erase(found);
+            return false;
+        }
+        return true;
+    }
+
+    static bool sameOwner(const weak_ptr <PassengerOwner> &first, const weak_ptr <PassengerOwner> &second) {
+        return !first.owner_before(second) && !second.owner_before(first);
+    }
+
+    void completed(const shared_ptr <Subscriber> &subscriber) {
+        shared_ptr<const Message> next;
+        {
+            lock_guard <mutex> lock(queueMutex);
+            if (subscriber->pending.empty()) {
+                subscriber->inFlight = false;
+                return;
+            }
+            next = subscriber->pending.front();
+            subscriber->pending.pop_front();
+        }
+        send(subscriber, next);
+    }
+
+    void run() {
+        while (true) {
+            Broadcast broadcast;
+            vector <pair<shared_ptr<Subscriber>, shared_ptr<const Message>>> toSend;
+            {
+                unique_lock <mutex> lock(queueMutex);
+                broadcastReady.wait(lock, [this]() { return stopping || !broadcasts.empty(); });
+                if (stopping) {
+                    return;
+                }
+                broadcast = move(broadcasts.front());
+                broadcasts.pop_front();
+                tracer().span(broadcast.message->trace, "notify.queue", broadcast.message->stop,
+                              broadcast.publishedAt, nowMicros());
+
+                for (const auto &passenger: broadcast.passengers) {
+                    Ice::Identity passengerKey = key(passenger);
+                    if (isDeadLocked(passengerKey)) {
+                        dropped++;
+                        continue;
+                    }
+                    auto &subscriber = subscribers[passengerKey];
+                    if (!subscriber) {
+                        subscriber = make_shared<Subscriber>();
+                        // bez limitu czasu wywolanie do zawieszonego pasazera nigdy by sie nie skonczylo
+                        subscriber->passenger = passenger->ice_invocationTimeout(livenessTimeout * 1000);
+                    }
+                    if (subscriber->inFlight) {
+                        enqueue(subscriber, broadcast.message);
+                    } else {
+                        subscriber->inFlight = true;
+                        toSend.emplace_back(subscriber, broadcast.message);
+                    }
+                }
+            }
+            for (const auto &entry: toSend) {
+                send(entry.first, entry.second);
+            }
+        }
+    }
+
+public:
+    NotificationEngine(int workersCount = 2, size_t queueCapacity = 16, int livenessTimeout = 60)
+            : queueCapacity(queueCapacity), livenessTimeout(livenessTimeout) {
+        for (int i = 0; i < workersCount; ++i) {
+            workers.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~NotificationEngine() {
+        {
+            lock_guard <mutex> lock(queueMutex);
+            stopping = true;
+        }
+        broadcastReady.notify_all();
+        for (auto &worker: workers) {
+            worker.join();
+        }
+    }
+
+    // Zwraca od razu; rozeslaniem do pasazerow zajmuja sie watki silnika.
+    // Puste `key` oznacza powiadomienie, ktore nigdy nie jest scalane z innymi.
+    // Powiadomienie o sledzonym przyjezdzie (`trace`) zapisuje odcinki kolejki i dostarczenia.
+    void publish(vector <shared_ptr<PassengerPrx>> passengers, string key, string info,
+                 TraceEvent trace = TraceEvent(), string stop = "") {
+        if (passengers.empty()) {
+            return;
+        }
+        fanOut.record(passengers.size());
+        auto message = make_shared<Message>();
+        message->key = move(key);
+        auto communicator = passengers.front()->ice_getCommunicator();
+        for (const auto &passenger: passengers) {
+            const Ice::EncodingVersion &encoding = passenger->ice_getEncodingVersion();
+            bool known = false;
+            for (const auto &encoded: message->encoded) {
+                known = known || encoded.first == encoding;
+            }
+            if (!known) {
+                message->encoded.emplace_back(encoding, encodeParams(communicator, encoding, info));
+            }
+        }
+        message->trace = trace;
+        message->context = trace.toContext();
+        message->stop = move(stop);
+        Broadcast broadcast;
+        broadcast.passengers = move(passengers);
+        broadcast.message = move(message);
+        if (trace.traced()) {
+            broadcast.publishedAt = nowMicros();
+        }
+        {
+            lock_guard <mutex> lock(queueMutex);
+            broadcasts.push_back(move(broadcast));
+        }
+        published++;
+        broadcastReady.notify_one();
+    }
+
+    void removeSubscriber(const shared_ptr <PassengerPrx> &passenger) {
+        lock_guard <mutex> lock(queueMutex);
+        subscribers.erase(key(passenger));
+    }
+
+    bool isDead(const shared_ptr <PassengerPrx> &passenger) {
+        lock_guard <mutex> lock(queueMutex);
+        return isDeadLocked(key(passenger));
+    }
+
+    // pasazer, ktory zapisuje sie ponownie (np. po restarcie), znow dostaje powiadomienia
+    void revive(const shared_ptr <PassengerPrx> &passenger) {
+        lock_guard <mutex> lock(queueMutex);
+        deadPassengers.erase(key(passenger));
+    }
+
+    // pasazer jest na liscie servanta `owner`; wiele wywolan dla tej samej pary nic nie zmienia
+    void subscribed(const shared_ptr <PassengerPrx> &passenger, const shared_ptr <PassengerOwner> &owner) {
+        weak_ptr <PassengerOwner> weakOwner = owner;
+        lock_guard <mutex> lock(queueMutex);
+        auto &passengerOwners = owners[key(passenger)];
+        passengerOwners.erase(remove_if(passengerOwners.begin(), passengerOwners.end(),
+                                        [](const weak_ptr <PassengerOwner> &known) { return known.expired(); }),
+                              passengerOwners.end());
+        for (const auto &known: passengerOwners) {
+            if (sameOwner(known, weakOwner)) {
+                return;
+            }
+        }
+        passengerOwners.push_back(weakOwner);
+    }
+
+    void unsubscribed(const shared_ptr <PassengerPrx> &passenger, const shared_ptr <PassengerOwner> &owner) {
+        weak_ptr <PassengerOwner> weakOwner = owner;
+        lock_guard <mutex> lock(queueMutex);
+        auto found = owners.find(key(passenger));
+        if (found == owners.end()) {
+            return;
+        }
+        found->second.erase(remove_if(found->second.begin(), found->second.end(),
+                                      [&weakOwner](const weak_ptr <PassengerOwner> &known) {
+                                          return known.expired() || sameOwner(known, weakOwner);
+                                      }), found->second.end());
+        if (found->second.empty()) {
+            owners.erase(found);
+        }
+    }
+
+    // usuwa ze zbioru servanta pasazerow uznanych za martwych; zwraca ich liczbe
+    size_t dropDead(IdentitySet <shared_ptr<PassengerPrx>> &passengers) {
+        lock_guard <mutex> lock(queueMutex);
+        if (deadPassengers.empty()) {
+            return 0;
+        }
+        return passengers.removeIf([this](const shared_ptr <PassengerPrx> &passenger) {
+            return isDeadLocked(key(passenger));
+        });
+    }
+
+    Histogram &getFanOut() {
+        return fanOut;
+    }
+
+    // powiadomienia czekajace na watki silnika i w kolejkach pasazerow
+    Ice::Long queueDepth() {
+        lock_guard <mutex> lock(queueMutex);
+        size_t depth = broadcasts.size();
+        for (const auto &subscriber: subscribers) {
+            depth += subscriber.second->pending.size();
+        }
+        return static_cast<Ice::Long>(depth);
+    }
+
+    // rosnie z kazdym pasazerem uznanym za martwego - servanty sprzataja listy tylko, gdy sie zmieni
+    Ice::Long deadCount() const {
+        return dead;
+    }
+
+    Stats getStats() {
+        Stats stats;
+        stats.published = published;
+        stats.delivered = delivered;
+        stats.coalesced = coalesced;
+        stats.dropped = dropped;
+        stats.failed = failed;
+        stats.dead = dead;
+        return stats;
+    }
+};
+
+#endif
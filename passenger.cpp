@@ -1,65 +1,279 @@
 #include <Ice/Ice.h>
 #include "MPK.h"
+#include "threadpool.h"
+#include "trace.h"
 #include <iostream>
 #include <memory>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
 
 using namespace std;
 using namespace SIP;
 
-class PassengerI : public SIP::Passenger {
+// powiadomienia przychodza z watkow Ice, a polecenia z glownego watku - wypisywanie jest wspolne
+mutex consoleMutex;
+
+// Lokalna kopia obrazu sieci: linie, przystanki i numery tramwajow. Zaczyna od pelnego obrazu,
+// a potem przyjmuje roznice wypychane przez MPK, wiec klient nigdy nie pyta o nazwy zdalnie.
+class NetworkCache {
 private:
-    string stopName = "";
+    mutex cacheMutex;
+    Ice::Long version = -1;
+    map<int, StopEntry> stops;
+    map<int, LineEntry> lines;
+    unordered_map <string, int> stopsByName;
+    unordered_map <string, string> stopNames;
+    unordered_map<int, string> stockNumbers;
+    unordered_map <string, string> tramNames;
+    unordered_map <string, shared_ptr<TramPrx>> tramsByNumber;
+
+    static string key(const Ice::ObjectPrxPtr &prx) {
+        return Ice::identityToString(prx->ice_getIdentity());
+    }
+
+    // wywolywane pod cacheMutex; tramwaj moze przejsc z linii na linie, wiec indeks jest liczony od nowa
+    void reindexTrams() {
+        stockNumbers.clear();
+        tramNames.clear();
+        tramsByNumber.clear();
+        for (const auto &line: lines) {
+            for (const auto &tram: line.second.trams) {
+                stockNumbers[tram.id] = tram.stockNumber;
+                tramNames[key(tram.tram)] = tram.stockNumber;
+                tramsByNumber[tram.stockNumber] = tram.tram;
+            }
+        }
+    }
+
 public:
-    void setTramStopName(string name) {
-        stopName = name;
+    Ice::Long getVersion() {
+        lock_guard <mutex> lock(cacheMutex);
+        return version;
     }
 
+    // Zwraca false, gdy paczka zaczyna sie za lokalna wersja (zgubiona paczka albo paczka, ktora
+    // wyprzedzila pelny obraz) - wtedy brakujace zmiany trzeba dociagnac. Pelny obraz ma
+    // sinceVersion == -1. Paczki starsze od lokalnej wersji sa pomijane.
+    bool apply(Ice::Long sinceVersion, const NetworkSnapshot &changes) {
+        lock_guard <mutex> lock(cacheMutex);
+        if (changes.version <= version) {
+            return true;
+        }
+        if (sinceVersion > version) {
+            return false;
+        }
+        for (const auto &stop: changes.stops) {
+            auto previous = stops.find(stop.id);
+            if (previous != stops.end()) {
+                stopNames.erase(key(previous->second.stop));
+            }
+            stops[stop.id] = stop;
+            stopsByName[stop.name] = stop.id;
+            stopNames[key(stop.stop)] = stop.name;
+        }
+        for (const auto &line: changes.lines) {
+            lines[line.id] = line;
+        }
+        if (!changes.lines.empty()) {
+            reindexTrams();
+        }
+        version = changes.version;
+        return true;
+    }
+
+    shared_ptr <TramStopPrx> findStop(const string &name) {
+        lock_guard <mutex> lock(cacheMutex);
+        auto found = stopsByName.find(name);
+        return found == stopsByName.end() ? nullptr : stops.at(found->second).stop;
+    }
+
+    shared_ptr <TramPrx> findTram(const string &stockNumber) {
+        lock_guard <mutex> lock(cacheMutex);
+        auto found = tramsByNumber.find(stockNumber);
+        return found == tramsByNumber.end() ? nullptr : found->second;
+    }
+
+    string stopName(const shared_ptr <TramStopPrx> &stop) {
+        lock_guard <mutex> lock(cacheMutex);
+        auto found = stopNames.find(key(stop));
+        return found == stopNames.end() ? "?" : found->second;
+    }
+
+    string stopName(int id) {
+        lock_guard <mutex> lock(cacheMutex);
+        auto found = stops.find(id);
+        return found == stops.end() ? "?" : found->second.name;
+    }
+
+    string stockNumber(const shared_ptr <TramPrx> &tram) {
+        lock_guard <mutex> lock(cacheMutex);
+        auto found = tramNames.find(key(tram));
+        return found == tramNames.end() ? "?" : found->second;
+    }
+
+    string stockNumber(int id) {
+        lock_guard <mutex> lock(cacheMutex);
+        auto found = stockNumbers.find(id);
+        return found == stockNumbers.end() ? "?" : found->second;
+    }
+
+    void printLines() {
+        lock_guard <mutex> lock(cacheMutex);
+        cout << "Dostepne linie: " << endl << endl;
+        for (const auto &line: lines) {
+            cout << "Linia nr: " << line.second.name << endl << "\t Przystanki: " << endl;
+            for (int stopId: line.second.stops) {
+                auto stop = stops.find(stopId);
+                cout << "\t\t" << (stop == stops.end() ? "?" : stop->second.name) << endl;
+            }
+            cout << "\t Tramwaje nr: ";
+            for (const auto &tram: line.second.trams) {
+                cout << tram.stockNumber << " ";
+            }
+            cout << endl << endl;
+        }
+    }
+
+    void printStops() {
+        lock_guard <mutex> lock(cacheMutex);
+        cout << "Dostepne przystanki: " << endl;
+        for (const auto &stop: stops) {
+            cout << "\t" << stop.second.name << endl;
+        }
+    }
+};
+
+class PassengerI : public SIP::Passenger {
+private:
+    shared_ptr <NetworkCache> cache;
+public:
+    explicit PassengerI(shared_ptr <NetworkCache> cache) : cache(cache) {}
+
     void updateTramInfo(shared_ptr <TramPrx> tram, StopList stops, const Ice::Current &current) override {
-        cout << "Aktualizacje tramwaju: " << tram->getStockNumber() << endl;
+        lock_guard <mutex> lock(consoleMutex);
+        cout << "Aktualizacje tramwaju: " << cache->stockNumber(tram) << endl;
         cout << "Następne przystanki:" << endl;
 
         // Wypisujemy listę przystanków, na które tramwaj ma dotrzeć
         for (const auto &stop: stops) {
-            cout << "- " << stop.stop->getName() << " o godzinie "
+            cout << "- " << cache->stopName(stop.stop) << " o godzinie "
                  << stop.time.hour << ":" << stop.time.minute << endl;
         }
     }
 
     void updateStopInfo(shared_ptr <TramStopPrx> tramStop, TramList tramList, const Ice::Current &current) override {
+        lock_guard <mutex> lock(consoleMutex);
         for (int i = 0; i < tramList.size(); ++i) {
             TramInfo tramInfo = tramList.at(i);
-            cout << "\t\t Tramwaj nr: " << tramInfo.tram->getStockNumber()
+            cout << "\t\t Tramwaj nr: " << cache->stockNumber(tramInfo.tram)
                  << "\t Czas przybycia: " << tramInfo.time.hour << ":" << tramInfo.time.minute << endl;
         }
     };
 
     void notifyPassenger(string info, const Ice::Current &current) override {
+        // caly czas od przyjazdu tramwaju, widziany po stronie pasazera
+        TraceEvent trace = TraceEvent::fromContext(current.ctx);
+        tracer().span(trace, "passenger.receive", current.id.name, trace.origin, nowMicros());
+        lock_guard <mutex> lock(consoleMutex);
         cout << info << endl;
     }
 
 };
 
-//enum subscription_type {TRAM, STOP};
-
-//bool checkName(string tramStopName, StopList allStops, enum subscription_type type){
-//    if(type == TRAM){
-//        for(int i = 0; i < allStops.size(); ++i){
-//            if(tramStopName == allStops.at(i).stop->getName()){
-//                return true;
-//            }
-//        }
-//    }
-//    else{
-//        for(int i = 0; i < allStops.size(); ++i){
-//            if(tramStopName == allStops.at(i).stop->getName()){
-//                return true;
-//            }
-//        }
-//    }
-//    return false;
-//}
+// Przyjmuje paczki zmian sieci wypychane przez MPK. Gdy paczka nie styka sie z lokalna wersja,
+// brakujace zmiany sa dociagane jednym wywolaniem getNetworkChanges.
+class NetworkObserverI : public SIP::NetworkObserver {
+private:
+    shared_ptr <NetworkCache> cache;
+    shared_ptr <MPKPrx> mpk;
+public:
+    NetworkObserverI(shared_ptr <NetworkCache> cache, shared_ptr <MPKPrx> mpk) : cache(cache), mpk(mpk) {}
+
+    void networkChanged(Ice::Long sinceVersion, NetworkSnapshot changes, const Ice::Current &current) override {
+        if (!cache->apply(sinceVersion, changes)) {
+            Ice::Long version = cache->getVersion();
+            cache->apply(version, mpk->getNetworkChanges(version));
+            cache->apply(sinceVersion, changes);
+        }
+    }
+};
+
+// strony przychodza z jednej migawki tablicy, wiec kazdy przyjazd jest przesylany raz
+void printArrivals(const shared_ptr <TramStopPrx> &tramStop, NetworkCache &cache) {
+    const int pageSize = 20;
+    const int maxRestarts = 3;
+    TramTimeList fullTramList;
+    Ice::Long cursor = 0;
+    int restarts = 0;
+    while (true) {
+        TramTimePage page;
+        try {
+            page = tramStop->getNextTramPage(cursor, pageSize);
+        } catch (const CursorExpiredException &) {
+            // przystanek zostal w miedzyczasie wyeksmitowany albo kursor wygasl - od poczatku,
+            // a gdy to sie powtarza, cala tablica jednym wywolaniem
+            fullTramList.clear();
+            cursor = 0;
+            if (++restarts > maxRestarts) {
+                fullTramList = tramStop->getNextTramIds(numeric_limits<int>::max());
+                break;
+            }
+            continue;
+        }
+        fullTramList.insert(fullTramList.end(), page.trams.begin(), page.trams.end());
+        cursor = page.cursor;
+        if (cursor == 0) {
+            break;
+        }
+    }
+
+    lock_guard <mutex> lock(consoleMutex);
+    for (const auto &tramTime: fullTramList) {
+        cout << "\t\t Tramwaj nr: " << cache.stockNumber(tramTime.tram)
+             << "\t Czas przybycia: " << tramTime.minuteOfDay / 60 << ":" << tramTime.minuteOfDay % 60 << endl;
+    }
+}
+
+SubscriptionFilter readFilter() {
+    SubscriptionFilter filter;
+    string input;
+    cout << "Podaj linie oddzielone spacjami lub '-' dla wszystkich: " << endl;
+    getline(cin, input);
+    istringstream lineStream(input);
+    string lineName;
+    while (lineStream >> lineName) {
+        if (lineName != "-") {
+            filter.lines.push_back(lineName);
+        }
+    }
+    cout << "Ile najblizszych przyjazdow sledzic (0 - wszystkie): " << endl;
+    getline(cin, input);
+    filter.nextArrivals = atoi(input.c_str());
+    cout << "Powiadamiaj o przyjazdach w ciagu ilu minut (0 - bez limitu): " << endl;
+    getline(cin, input);
+    filter.withinMinutes = atoi(input.c_str());
+    return filter;
+}
+
+void printHelp() {
+    lock_guard <mutex> lock(consoleMutex);
+    cout << "Polecenia:" << endl
+         << "\tp <przystanek>\t\tsubskrybuj przystanek" << endl
+         << "\tf <przystanek>\t\tsubskrybuj przystanek z filtrem" << endl
+         << "\tt <tramwaj>\t\tsubskrybuj tramwaj" << endl
+         << "\tu <przystanek|tramwaj>\tzakoncz subskrypcje" << endl
+         << "\ta <przystanek>\t\tnajblizsze przyjazdy" << endl
+         << "\tk <tramwaj> <ile>\tkolejne przystanki tramwaju" << endl
+         << "\tl, s\t\t\tlinie, przystanki" << endl
+         << "\tx\t\t\tzapisz slad przyjazdow" << endl
+         << "\tq\t\t\tkoniec" << endl;
+}
 
 int main(int argc, char *argv[]) {
     string address = "";
@@ -100,12 +314,12 @@ int main(int argc, char *argv[]) {
     }
     cout << "Podaj imie mistrzu: " << endl;
     string nameUser;
-    cin >> nameUser;
-    std::cin.clear();
+    getline(cin, nameUser);
     Ice::CommunicatorPtr ic;
     try {
         // uzyskuje dostep do obiektu sip
-        ic = Ice::initialize(argc, argv);
+        // heartbeaty adaptera pasazera pozwalaja systemowi odroznic zywego pasazera od martwego
+        ic = initializeWithThreadPool(argc, argv);
         auto base = ic->stringToProxy(name + ":default -h " + address + " -p " + port + " -t 8000");
         auto mpk = Ice::checkedCast<MPKPrx>(base);
         if (!mpk) {
@@ -117,155 +331,125 @@ int main(int argc, char *argv[]) {
                                                                              "default -p " + tramPort);
 
         //tworze servant użytkownika
-        auto passenger = make_shared<PassengerI>();
+        auto cache = make_shared<NetworkCache>();
+        auto passenger = make_shared<PassengerI>(cache);
         auto passengerPrx = Ice::uncheckedCast<PassengerPrx>(adapter->addWithUUID(passenger));
         adapter->add(passenger, Ice::stringToIdentity(nameUser));
-        //pobieram dostepne linie
-        LineList lines = mpk->getLines();
-
-        //wyswietlam informacje o dostepnych liniach i tramwajach
-
-        //       StopList newStopList = lines.at(0)->getStops();
-
-//        TramList tramList2 = newStopList.at(0).stop->getNextTrams(1);
-//
-//        for(int i = 0; i < tramList2.size(); ++i){
-//            cout << tramList2.at(i).tram->getStockNumber() << endl;
-//        }
-
-        StopList allStops;
-        cout << "Dostepne linie: " << endl << endl;
-        for (int index = 0; index < lines.size(); ++index) {
-            cout << "Linia nr: " << lines.at(index)->getName() << endl << "\t Przystanki: " << endl;
-            StopList tramStops = lines.at(index)->getStops();
-
-            cout << "stopy ilosc: " << tramStops.size() << endl;
-
-            for (int stopIndex = 0; stopIndex < tramStops.size(); stopIndex++) {
-                shared_ptr <TramStopPrx> tramStop = tramStops.at(stopIndex).stop;
-                cout << "\t\t" << tramStop->getName() << endl;
-                bool found = false;
-                for (int indexAllStop = 0; indexAllStop < allStops.size(); indexAllStop++) {
-                    if (allStops.at(indexAllStop).stop->getName() == tramStop->getName()) {
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    StopInfo stopInfo;
-                    stopInfo.stop = tramStop;
-                    allStops.push_back(stopInfo);
-                }
-            }
-
-            cout << endl;
-            TramList trams = lines.at(index)->getTrams();
-            cout << "\t Tramwaje nr: ";
-            for (int tramIndex = 0; tramIndex < trams.size(); tramIndex++) {
-                cout << trams.at(tramIndex).tram->getStockNumber() << " ";
-            }
-            cout << endl << endl;
-        }
-
-        //wyswietlam info o przystankach i tramwajach
-        cout << endl;
-        cout << "Dostępne przystanki: " << endl;
-        for (int stopIndex = 0; stopIndex < allStops.size(); stopIndex++) {
-            shared_ptr<TramStopPrx> tramStop = allStops.at(stopIndex).stop;
-            cout << "\t" << tramStop->getName() << endl;
-
-            TramList fullTramList;
-            int batchSize = 5;
-            int totalFetched = 0;
-
-            while (true) {
-                TramList batch = tramStop->getNextTrams(totalFetched + batchSize);
-
-                // Jeśli liczba tramwajów się nie zmieniła, znaczy że nic nowego nie doszło
-                if (batch.size() == fullTramList.size()) {
-                    break;
-                }
-
-                fullTramList = batch;
-                totalFetched += batchSize;
-            }
+        auto observerPrx = Ice::uncheckedCast<NetworkObserverPrx>(
+                adapter->addWithUUID(make_shared<NetworkObserverI>(cache, mpk)));
+        adapter->activate();
 
-            passenger->updateStopInfo(tramStop, fullTramList, Ice::Current());
+        //pelny obraz sieci przychodzi raz, dalej MPK wypycha tylko zmiany
+        cache->apply(-1, mpk->addNetworkObserver(observerPrx));
+        {
+            lock_guard <mutex> lock(consoleMutex);
+            cache->printLines();
         }
-
-        cout << endl << endl;
-
-        //pobieram informacje uzytkownika co chce sledzic
-        char choice;
-        string name;
-        cout << "Wybierz co chcesz zasubskrybowac: 'p' - przystanek, 't' - tramwaj" << endl;
-        cin >> choice;
-        if (choice == 'p') cout << "Podaj nazwe przystanku: " << endl;
-        else if (choice == 't') cout << "Podaj numer tramwaju: " << endl;
-        else throw "Niepoprawny wybor subskrypcji";
-        cin >> name;
-//        while(!checkName(name, allStops)){
-//            cout << "Niepoprawna nazwa, wybierz ponownie" << endl;
-//            cin >> name;
-//        }
-
-
-        //rejestruje uzytkownika
-        adapter->activate();
-        shared_ptr <TramPrx> tram = nullptr;
-        shared_ptr <TramStopPrx> tramStop = nullptr;
-        char sign;
-        cout << "DUPA3" << endl;
-        if (choice == 'p') {
-            cout << "DUPA1" << endl;
-            tramStop = mpk->getTramStop(name);
-            if (tramStop) {
-                tramStop->RegisterPassenger(passengerPrx);
-                passenger->setTramStopName(name);
-                cout << "Zasubskrybowales przystanek: " << name << endl;
-                while (1) {
-//                    cout << "dupka" << endl;
-                }
-            } else {
-                throw "Nie znaleziono takiego przystanku";
+        printHelp();
+
+        map <string, shared_ptr<TramStopPrx>> stopSubscriptions;
+        map <string, shared_ptr<TramPrx>> tramSubscriptions;
+
+        //glowny watek spi na odczycie polecen; powiadomienia obsluguja watki Ice
+        string commandLine;
+        while (getline(cin, commandLine)) {
+            istringstream commandStream(commandLine);
+            char command = 0;
+            string argument;
+            commandStream >> command >> argument;
+            if (command == 'q') {
+                break;
             }
-        } else {
-            for (int index = 0; index < lines.size(); index++) {
-
-                TramList trams = lines.at(index)->getTrams();
-                for (int tramIndex = 0; tramIndex < trams.size(); tramIndex++) {
-                    if (trams.at(tramIndex).tram->getStockNumber() == name) {
-                        tram = trams.at(tramIndex).tram;
-                        break;
+            try {
+                if (command == 'p' || command == 'f') {
+                    auto tramStop = cache->findStop(argument);
+                    if (!tramStop) {
+                        tramStop = mpk->getTramStop(argument);
                     }
+                    if (!tramStop) {
+                        cout << "Nie znaleziono takiego przystanku" << endl;
+                        continue;
+                    }
+                    if (command == 'p') {
+                        tramStop->RegisterPassenger(passengerPrx);
+                    } else {
+                        tramStop->RegisterFilteredPassenger(passengerPrx, readFilter());
+                    }
+                    stopSubscriptions[argument] = tramStop;
+                    cout << "Zasubskrybowales przystanek: " << argument << endl;
+                } else if (command == 't') {
+                    auto tram = cache->findTram(argument);
+                    if (!tram) {
+                        cout << "Nie znalezionio tramwaju o podanym numerze" << endl;
+                        continue;
+                    }
+                    tram->RegisterPassenger(passengerPrx);
+                    tramSubscriptions[argument] = tram;
+                    cout << "Zasubskrybowales tramwaj: " << argument << endl;
+                } else if (command == 'u') {
+                    auto stop = stopSubscriptions.find(argument);
+                    auto tram = tramSubscriptions.find(argument);
+                    if (stop != stopSubscriptions.end()) {
+                        stop->second->UnregisterPassenger(passengerPrx);
+                        stopSubscriptions.erase(stop);
+                        cout << "Wyrejestrowano z przystanku: " << argument << endl;
+                    } else if (tram != tramSubscriptions.end()) {
+                        tram->second->UnregisterPassenger(passengerPrx);
+                        tramSubscriptions.erase(tram);
+                        cout << "Wyrejestrowano z tramwaju: " << argument << endl;
+                    } else {
+                        cout << "Brak takiej subskrypcji" << endl;
+                    }
+                } else if (command == 'a') {
+                    auto tramStop = cache->findStop(argument);
+                    if (tramStop) {
+                        printArrivals(tramStop, *cache);
+                    } else {
+                        cout << "Nie znaleziono takiego przystanku" << endl;
+                    }
+                } else if (command == 'k') {
+                    auto tram = cache->findTram(argument);
+                    int numberOfStops = 0;
+                    commandStream >> numberOfStops;
+                    if (!tram) {
+                        cout << "Nie znalezionio tramwaju o podanym numerze" << endl;
+                        continue;
+                    }
+                    StopTimeList nextStops = tram->getNextStopIds(numberOfStops);
+                    lock_guard <mutex> lock(consoleMutex);
+                    cout << "Następne przystanki:" << endl;
+                    for (const auto &stopTime: nextStops) {
+                        cout << "- " << cache->stopName(stopTime.stop) << " o godzinie "
+                             << stopTime.minuteOfDay / 60 << ":" << stopTime.minuteOfDay % 60 << endl;
+                    }
+                } else if (command == 'l') {
+                    lock_guard <mutex> lock(consoleMutex);
+                    cache->printLines();
+                } else if (command == 's') {
+                    lock_guard <mutex> lock(consoleMutex);
+                    cache->printStops();
+                } else if (command == 'x') {
+                    string traceFile = traceFilePath(ic->getProperties());
+                    lock_guard <mutex> lock(consoleMutex);
+                    cout << (tracer().dump(traceFile) ? "Slad zapisany w " : "Nie mozna zapisac ") << traceFile
+                         << endl;
+                } else if (command != 0) {
+                    printHelp();
                 }
-                if (tram) break;
-            }
-            if (tram) tram->RegisterPassenger(passengerPrx);
-            else throw "Nie znalezionio tramwaju o podanym numerze";
-
-            cout << "Klikniecie klawisza 'q' zakonczy program" << endl;
-            cout << "Jesli chcesz poznac jakie sa kolejne przystanki, kliknij 'k'" << endl;
-            while (true) {
-                cin >> sign;
-                if (sign == 'k') {
-                    cout << "Podaj ilosc przystankow jaka chcesz zobaczyc: " << endl;
-                    int number_of_stops;
-                    cin >> number_of_stops;
-                    StopList nextStops = tram->getNextStops(number_of_stops);
-                    passenger->updateTramInfo(tram, nextStops, Ice::Current());
-                }
-                if (sign == 'q') break;
+            } catch (const Ice::Exception &e) {
+                cout << e << endl;
             }
         }
 
-        if (choice == 'u') {
-            cout << "Wyrejestrowuje z przystanku" << endl;
-            tramStop->UnregisterPassenger(passengerPrx);
-        } else {
-            cout << "Wyrejestrowuje z tramwaju" << endl;
-            tram->UnregisterPassenger(passengerPrx);
+        for (const auto &stop: stopSubscriptions) {
+            cout << "Wyrejestrowuje z przystanku " << stop.first << endl;
+            stop.second->UnregisterPassenger(passengerPrx);
         }
+        for (const auto &tram: tramSubscriptions) {
+            cout << "Wyrejestrowuje z tramwaju " << tram.first << endl;
+            tram.second->UnregisterPassenger(passengerPrx);
+        }
+        mpk->removeNetworkObserver(observerPrx);
 
     } catch (const Ice::Exception &e) {
         cout << e << endl;
@@ -283,5 +467,3 @@ int main(int argc, char *argv[]) {
 
     cout << "Koniec programu uzytkownika" << endl;
 }
-
-
@@ -0,0 +1,340 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <Ice/Ice.h>
+#include "tram.h"
+#include "metrics.h"
+#include <iostream>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+using namespace std;
+using namespace SIP;
+
+// Flota tramwajow jezdzaca bez konsoli - wspolna dla ./simulator (MPK w innym procesie)
+// i ./collocated (MPK, przystanki i linie w tym samym komunikatorze).
+
+typedef chrono::steady_clock Clock;
+
+// Pasazer-sonda: subskrybuje wszystkie tramwaje floty i mierzy czas od rozpoczecia
+// dojazdu tramwaju do przystanku do otrzymania powiadomienia o tym dojezdzie.
+class ProbePassenger : public SIP::Passenger {
+private:
+    mutex probeMutex;
+    map <string, Clock::time_point> pendingArrivals;
+    vector<double> latenciesMs;
+public:
+    void arrivalStarted(const string &stockNumber) {
+        lock_guard <mutex> lock(probeMutex);
+        pendingArrivals[stockNumber] = Clock::now();
+    }
+
+    // zwraca probki zebrane od ostatniego wywolania
+    vector<double> takeLatencies() {
+        lock_guard <mutex> lock(probeMutex);
+        vector<double> samples;
+        samples.swap(latenciesMs);
+        return samples;
+    }
+
+    void updateTramInfo(shared_ptr <TramPrx> tram, StopList stops, const Ice::Current &current) override {}
+
+    void updateStopInfo(shared_ptr <TramStopPrx> tramStop, TramList tramList, const Ice::Current &current) override {}
+
+    void notifyPassenger(string info, const Ice::Current &current) override {
+        // "Tramwaj <numer> dojechal do <przystanek>"
+        const string prefix = "Tramwaj ";
+        if (info.compare(0, prefix.size(), prefix) != 0) {
+            return;
+        }
+        string stockNumber = info.substr(prefix.size(), info.find(' ', prefix.size()) - prefix.size());
+        lock_guard <mutex> lock(probeMutex);
+        auto found = pendingArrivals.find(stockNumber);
+        if (found != pendingArrivals.end()) {
+            latenciesMs.push_back(chrono::duration<double, milli>(Clock::now() - found->second).count());
+            pendingArrivals.erase(found);
+        }
+    }
+};
+
+struct SimulatedTram {
+    shared_ptr <TramI> servant;
+    shared_ptr <TramPrx> prx;
+    shared_ptr <LinePrx> line;
+    string stockNumber;
+    size_t stopsCount = 0;
+    // przystanki od ostatniego ogloszenia rozkladu; co okrazenie rozklad jest ogloszony od nowa
+    size_t stopsSinceTimetable = 0;
+};
+
+struct Arrival {
+    Clock::time_point due;
+    int tram;
+
+    bool operator>(const Arrival &other) const {
+        return due > other.due;
+    }
+};
+
+// Plik floty ma format jak lines.txt: "<linia>: <numer> <numer> <od>-<do> ..."
+inline vector <pair<string, string>> readFleet(string fileName) {
+    ifstream fleetFile(fileName);
+    if (!fleetFile.is_open()) {
+        cerr << "Nie można otworzyć pliku floty: " << fileName << endl;
+        throw "File error";
+    }
+    vector <pair<string, string>> fleet;
+    string fileLine;
+    while (getline(fleetFile, fileLine)) {
+        size_t separator_position = fileLine.find(':');
+        if (separator_position == string::npos) {
+            continue;
+        }
+        string lineName = fileLine.substr(0, separator_position);
+        istringstream iss(fileLine.substr(separator_position + 1));
+        string token;
+        while (iss >> token) {
+            size_t dash = token.find('-');
+            if (dash == string::npos) {
+                fleet.emplace_back(token, lineName);
+                continue;
+            }
+            int from = stoi(token.substr(0, dash));
+            int to = stoi(token.substr(dash + 1));
+            for (int number = from; number <= to; ++number) {
+                fleet.emplace_back(to_string(number), lineName);
+            }
+        }
+    }
+    return fleet;
+}
+
+inline double percentile(vector<double> &samples, double p) {
+    if (samples.empty()) {
+        return 0;
+    }
+    size_t index = min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+    nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples.at(index);
+}
+
+// Pasazerowie-tlo: jeden servant pod wieloma tozsamosciami, kazdy subskrybuje jeden przystanek.
+// Licza tylko powiadomienia, zeby obciazenie przystankow bylo jak przy prawdziwych pasazerach.
+class CountingPassenger : public SIP::Passenger {
+public:
+    atomic<long long> notifications{0};
+
+    void updateTramInfo(shared_ptr <TramPrx> tram, StopList stops, const Ice::Current &current) override {}
+
+    void updateStopInfo(shared_ptr <TramStopPrx> tramStop, TramList tramList, const Ice::Current &current) override {}
+
+    void notifyPassenger(string info, const Ice::Current &current) override {
+        notifications++;
+    }
+};
+
+struct SimulationOptions {
+    string fleetFileName = "fleet.txt";
+    int dwellMs = 2000;
+    int travelMs = 8000;
+    int durationS = 60;
+    int workersCount = 8;
+    // pasazerowie subskrybujacy przystanki (po kolei, po jednym na przystanek)
+    int passengersCount = 0;
+};
+
+struct SimulationResult {
+    long long events = 0;
+    long long notifications = 0;
+    double seconds = 0;
+    vector<double> latenciesMs;
+};
+
+// Rejestruje flote i pasazerow na aktywnym adapterze, jezdzi przez options.durationS sekund,
+// co sekunde wypisujac tempo zdarzen, a na koniec zjezdza do zajezdni i wyrejestrowuje pasazerow.
+inline SimulationResult runSimulation(Ice::ObjectAdapterPtr adapter, shared_ptr <MPKPrx> mpk,
+                                      shared_ptr <NotificationEngine> notifier, const SimulationOptions &options) {
+    int dwellMs = options.dwellMs;
+    int travelMs = options.travelMs;
+    SimulationResult result;
+
+    NetworkSnapshot network = mpk->getNetwork();
+    map <string, LineEntry> linesByName;
+    for (const auto &lineEntry: network.lines) {
+        linesByName[lineEntry.name] = lineEntry;
+    }
+    auto depo = mpk->getDepo("Zajezdnia1");
+    if (!depo) {
+        throw "Nie znaleziono zajezdni";
+    }
+
+    auto probe = make_shared<ProbePassenger>();
+    auto probePrx = Ice::uncheckedCast<PassengerPrx>(adapter->addWithUUID(probe));
+    auto ids = make_shared<IdDirectory>(mpk);
+
+    auto counting = make_shared<CountingPassenger>();
+    adapter->addDefaultServant(counting, "symulacja");
+    vector <pair<shared_ptr<TramStopPrx>, shared_ptr<PassengerPrx>>> subscriptions;
+    for (int i = 0; i < options.passengersCount && !network.stops.empty(); ++i) {
+        auto stop = network.stops.at(i % network.stops.size()).stop;
+        auto passenger = Ice::uncheckedCast<PassengerPrx>(
+                adapter->createProxy(Ice::Identity{to_string(i), "symulacja"}));
+        stop->RegisterPassenger(passenger);
+        subscriptions.emplace_back(stop, passenger);
+    }
+
+    chrono::milliseconds perStop(dwellMs + travelMs);
+    vector <SimulatedTram> trams;
+    for (const auto &assignment: readFleet(options.fleetFileName)) {
+        auto line = linesByName.find(assignment.second);
+        if (line == linesByName.end()) {
+            cout << "Pomijam tramwaj " << assignment.first << " - brak linii " << assignment.second << endl;
+            continue;
+        }
+        SimulatedTram tram;
+        tram.stockNumber = assignment.first;
+        tram.line = line->second.line;
+        tram.stopsCount = line->second.stops.size();
+        tram.servant = make_shared<TramI>(tram.stockNumber, notifier, ids);
+        // jak w ./tram - wywolania symulowanych tramwajow trafiaja do metryk operacji
+        tram.prx = Ice::uncheckedCast<TramPrx>(adapter->addWithUUID(make_shared<TimedServant>(tram.servant)));
+        tram.servant->setProxy(tram.prx);
+        tram.servant->setLine(tram.line, Ice::Current());
+        tram.servant->publishTimetable(perStop);
+        tram.servant->RegisterPassenger(probePrx, Ice::Current());
+        tram.line->registerTram(tram.prx);
+        depo->registerTram(tram.prx);
+        depo->TramOnline(tram.prx);
+        trams.push_back(tram);
+    }
+    cout << "Symulacja " << trams.size() << " tramwajow, " << subscriptions.size() << " pasazerow, postoj "
+         << dwellMs << " ms, przejazd " << travelMs << " ms" << endl;
+
+    //terminarz przyjazdow - tramwaje startuja rownomiernie rozlozone w czasie jednego cyklu
+    priority_queue <Arrival, vector<Arrival>, greater<Arrival>> agenda;
+    mutex agendaMutex;
+    condition_variable agendaChanged;
+    bool stopping = false;
+    long long events = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < trams.size(); ++i) {
+        Arrival arrival;
+        arrival.due = start + chrono::milliseconds((dwellMs + travelMs) * i / max<size_t>(1, trams.size()));
+        arrival.tram = static_cast<int>(i);
+        agenda.push(arrival);
+    }
+
+    vector <thread> workers;
+    for (int w = 0; w < options.workersCount; ++w) {
+        workers.emplace_back([&]() {
+            while (true) {
+                Arrival arrival;
+                {
+                    unique_lock <mutex> lock(agendaMutex);
+                    while (!stopping && (agenda.empty() || agenda.top().due > Clock::now())) {
+                        if (agenda.empty()) {
+                            agendaChanged.wait(lock);
+                        } else {
+                            Clock::time_point due = agenda.top().due;
+                            agendaChanged.wait_until(lock, due);
+                        }
+                    }
+                    if (stopping) {
+                        return;
+                    }
+                    arrival = agenda.top();
+                    agenda.pop();
+                }
+
+                SimulatedTram &tram = trams.at(arrival.tram);
+                probe->arrivalStarted(tram.stockNumber);
+                try {
+                    tram.servant->setNextStop();
+                    if (++tram.stopsSinceTimetable >= tram.stopsCount) {
+                        tram.servant->publishTimetable(perStop);
+                        tram.stopsSinceTimetable = 0;
+                    }
+                } catch (const Ice::Exception &e) {
+                    cerr << "Tramwaj " << tram.stockNumber << ": " << e << endl;
+                }
+
+                {
+                    lock_guard <mutex> lock(agendaMutex);
+                    events++;
+                    arrival.due += chrono::milliseconds(dwellMs + travelMs);
+                    agenda.push(arrival);
+                }
+                agendaChanged.notify_one();
+            }
+        });
+    }
+
+    //raport co sekunde: osiagniete tempo zdarzen i opoznienie przyjazd -> powiadomienie
+    long long reportedEvents = 0;
+    long long reportedNotifications = 0;
+    Clock::time_point lastReport = start;
+    while (Clock::now() - start < chrono::seconds(options.durationS)) {
+        this_thread::sleep_for(chrono::seconds(1));
+        long long currentEvents;
+        {
+            lock_guard <mutex> lock(agendaMutex);
+            currentEvents = events;
+        }
+        Clock::time_point now = Clock::now();
+        double seconds = chrono::duration<double>(now - lastReport).count();
+        vector<double> latencies = probe->takeLatencies();
+        long long currentNotifications = counting->notifications;
+        cout << "zdarzenia/s: " << (currentEvents - reportedEvents) / seconds
+             << "\tpowiadomienia/s: " << (currentNotifications - reportedNotifications) / seconds
+             << "\topoznienie p50: " << percentile(latencies, 0.5) << " ms"
+             << "\tp99: " << percentile(latencies, 0.99) << " ms"
+             << "\tprobki: " << latencies.size() << endl;
+        result.latenciesMs.insert(result.latenciesMs.end(), latencies.begin(), latencies.end());
+        reportedEvents = currentEvents;
+        reportedNotifications = currentNotifications;
+        lastReport = now;
+    }
+
+    {
+        lock_guard <mutex> lock(agendaMutex);
+        stopping = true;
+    }
+    agendaChanged.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    result.events = events;
+    result.notifications = counting->notifications;
+    result.seconds = chrono::duration<double>(Clock::now() - start).count();
+    //podsumowanie calego przebiegu - te same liczby dla ./simulator i ./collocated
+    cout << "Lacznie zdarzen: " << result.events << " w " << result.seconds << " s ("
+         << result.events / max(result.seconds, 1e-9) << "/s), powiadomien pasazerow: " << result.notifications
+         << " (" << result.notifications / max(result.seconds, 1e-9) << "/s), opoznienie p50: "
+         << percentile(result.latenciesMs, 0.5) << " ms, p99: " << percentile(result.latenciesMs, 0.99) << " ms"
+         << endl;
+
+    //zjazd floty do zajezdni
+    for (auto &tram: trams) {
+        tram.line->unregisterTram(tram.prx);
+        depo->unregisterTram(tram.prx);
+        depo->TramOffline(tram.prx);
+    }
+    for (const auto &subscription: subscriptions) {
+        subscription.first->UnregisterPassenger(subscription.second);
+    }
+    adapter->removeDefaultServant("symulacja");
+    return result;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include <Ice/Ice.h>
+#include "simulation.h"
+#include "threadpool.h"
+#include <iostream>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+using namespace SIP;
+
+int main(int argc, char *argv[]) {
+    string address = "";
+    string port = "";
+    string name = "";
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0]
+             << " <simulatorPort ex. 10020> [fleet.txt] [dwellMs=2000] [travelMs=8000] [durationS=60] [workers=8]"
+             << " [passengers=0]"
+             << endl;
+        return 1;
+    }
+    string simulatorPort = argv[1];
+    SimulationOptions options;
+    options.fleetFileName = argc > 2 ? argv[2] : "fleet.txt";
+    options.dwellMs = argc > 3 ? stoi(argv[3]) : 2000;
+    options.travelMs = argc > 4 ? stoi(argv[4]) : 8000;
+    options.durationS = argc > 5 ? stoi(argv[5]) : 60;
+    options.workersCount = argc > 6 ? stoi(argv[6]) : 8;
+    options.passengersCount = argc > 7 ? stoi(argv[7]) : 0;
+
+    ifstream configFile("configfile.txt");
+    if (configFile.is_open()) {
+        string line;
+        while (getline(configFile, line)) {
+            istringstream iss(line);
+            string key, value;
+
+            if (getline(iss, key, '=') && getline(iss, value)) {
+                key.erase(remove_if(key.begin(), key.end(), ::isspace), key.end());
+                value.erase(remove_if(value.begin(), value.end(), ::isspace), value.end());
+
+                if (key == "address") {
+                    address = value;
+                } else if (key == "port") {
+                    port = value;
+                } else if (key == "name") {
+                    name = value;
+                }
+            }
+        }
+        configFile.close();
+    } else {
+        cerr << "Unable to open configfile.txt" << endl;
+        return 1;
+    }
+
+    if (address.empty() || port.empty() || name.empty()) {
+        cerr << "Missing required configuration parameters in configfile.txt" << endl;
+        cerr << "Required parameters: address, port, name" << endl;
+        return 1;
+    }
+
+    Ice::CommunicatorPtr ic;
+    try {
+        ic = initializeWithThreadPool(argc, argv);
+        auto base = ic->stringToProxy(name + ":default -h " + address + " -p " + port + " -t 8000");
+        auto mpk = Ice::checkedCast<MPKPrx>(base);
+        if (!mpk) {
+            throw "Invalid proxy";
+        }
+
+        //wszystkie tramwaje floty i pasazerowie zyja na jednym adapterze
+        Ice::ObjectAdapterPtr adapter = ic->createObjectAdapterWithEndpoints("SimulatorAdapter",
+                                                                             "default -p " + simulatorPort);
+        auto notifier = make_shared<NotificationEngine>(4);
+        adapter->activate();
+        runSimulation(adapter, mpk, notifier, options);
+
+    } catch (const Ice::Exception &e) {
+        cout << e << endl;
+    } catch (const char *msg) {
+        cout << msg << endl;
+    }
+
+    if (ic) {
+        try {
+            ic->destroy();
+        } catch (const Ice::Exception &e) {
+            cout << e << endl;
+        }
+    }
+
+    cout << "Koniec symulacji" << endl;
+}
@@ -0,0 +1,2373 @@
+#ifndef SYSTEM_H
+#define SYSTEM_H
+
+#include <Ice/Ice.h>
+#include "MPK.h"
+#include "notifier.h"
+#include "ids.h"
+#include "identityset.h"
+#include "metrics.h"
+#include "log.h"
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <list>
+#include <set>
+#include <limits>
+#include <ctime>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <cstdint>
+
+using namespace std;
+using namespace SIP;
+
+// Zdenormalizowany obraz calej sieci (linie, przystanki, tramwaje) utrzymywany przyrostowo.
+// Kazdy wpis pamieta wersje swojej ostatniej zmiany, wiec klient moze pobrac tylko roznice.
+class NetworkTopology {
+private:
+    shared_timed_mutex topologyMutex;
+    condition_variable_any topologyChanged;
+    Ice::Long version = 0;
+    vector <StopEntry> stops;
+    vector <Ice::Long> stopVersions;
+    unordered_map <string, int> stopIds;
+    vector <LineEntry> lines;
+    vector <Ice::Long> lineVersions;
+    unordered_map <string, int> lineIds;
+    unordered_map <string, vector<int>> linesByTram;
+    unordered_map <string, TramStatus> tramStatuses;
+    unordered_map <string, int> tramIds;
+
+    static string key(const Ice::Identity &identity) {
+        return Ice::identityToString(identity);
+    }
+
+    int findStopId(const Ice::Identity &stop) {
+        auto found = stopIds.find(key(stop));
+        return found == stopIds.end() ? -1 : found->second;
+    }
+
+    // wywolywane pod wylaczna blokada; budzi czekajacych na zmiane sieci
+    Ice::Long bump() {
+        topologyChanged.notify_all();
+        return ++version;
+    }
+
+    // wywolywane pod wylaczna blokada
+    int assignTramId(const string &tramKey) {
+        auto found = tramIds.find(tramKey);
+        if (found != tramIds.end()) {
+            return found->second;
+        }
+        int id = static_cast<int>(tramIds.size());
+        tramIds[tramKey] = id;
+        return id;
+    }
+
+public:
+    int addStop(string name, shared_ptr <TramStopPrx> stop) {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        int id = findStopId(stop->ice_getIdentity());
+        if (id != -1) {
+            return id;
+        }
+        StopEntry entry;
+        entry.id = static_cast<int>(stops.size());
+        entry.name = name;
+        entry.stop = stop;
+        stopIds[key(stop->ice_getIdentity())] = entry.id;
+        stops.push_back(entry);
+        stopVersions.push_back(bump());
+        return entry.id;
+    }
+
+    // przystanek przeniesiony do innego shardu zachowuje swoje id, zmienia sie tylko proxy
+    void replaceStop(shared_ptr <TramStopPrx> oldStop, shared_ptr <TramStopPrx> newStop) {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        int id = findStopId(oldStop->ice_getIdentity());
+        if (id == -1) {
+            return;
+        }
+        stopIds.erase(key(oldStop->ice_getIdentity()));
+        stopIds[key(newStop->ice_getIdentity())] = id;
+        stops.at(id).stop = newStop;
+        stopVersions.at(id) = bump();
+    }
+
+    int getStopId(shared_ptr <TramStopPrx> stop) {
+        shared_lock <shared_timed_mutex> lock(topologyMutex);
+        return findStopId(stop->ice_getIdentity());
+    }
+
+    void addLine(string name, shared_ptr <LinePrx> line) {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        if (lineIds.count(key(line->ice_getIdentity()))) {
+            return;
+        }
+        LineEntry entry;
+        entry.id = static_cast<int>(lines.size());
+        entry.name = name;
+        entry.line = line;
+        lineIds[key(line->ice_getIdentity())] = entry.id;
+        lines.push_back(entry);
+        lineVersions.push_back(bump());
+    }
+
+    // przystanek spoza rejestru MPK - jedno zdalne wywolanie przy pierwszym uzyciu, poza blokada
+    int resolveStopId(shared_ptr <TramStopPrx> stop) {
+        int id = getStopId(stop);
+        if (id == -1) {
+            id = addStop(stop->getName(), stop);
+        }
+        return id;
+    }
+
+    int getTramId(shared_ptr <TramPrx> tram) {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        return assignTramId(key(tram->ice_getIdentity()));
+    }
+
+    void setLineStops(const Ice::Identity &line, const StopList &stopList) {
+        IdList stopIdList;
+        for (const auto &stopInfo: stopList) {
+            stopIdList.push_back(resolveStopId(stopInfo.stop));
+        }
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        auto found = lineIds.find(key(line));
+        if (found == lineIds.end()) {
+            return;
+        }
+        lines.at(found->second).stops = stopIdList;
+        lineVersions.at(found->second) = bump();
+    }
+
+    void addTram(const Ice::Identity &line, string stockNumber, shared_ptr <TramPrx> tram) {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        auto found = lineIds.find(key(line));
+        if (found == lineIds.end()) {
+            return;
+        }
+        string tramKey = key(tram->ice_getIdentity());
+        TramEntry entry;
+        entry.id = assignTramId(tramKey);
+        entry.stockNumber = stockNumber;
+        entry.tram = tram;
+        auto status = tramStatuses.find(tramKey);
+        entry.status = status == tramStatuses.end() ? TramStatus::OFFLINE : status->second;
+        lines.at(found->second).trams.push_back(entry);
+        linesByTram[tramKey].push_back(found->second);
+        lineVersions.at(found->second) = bump();
+    }
+
+    void removeTram(const Ice::Identity &line, shared_ptr <TramPrx> tram) {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        auto found = lineIds.find(key(line));
+        if (found == lineIds.end()) {
+            return;
+        }
+        string tramKey = key(tram->ice_getIdentity());
+        TramEntryList &trams = lines.at(found->second).trams;
+        for (auto it = trams.begin(); it != trams.end(); ++it) {
+            if (it->tram->ice_getIdentity() == tram->ice_getIdentity()) {
+                trams.erase(it);
+                break;
+            }
+        }
+        vector<int> &tramLines = linesByTram[tramKey];
+        tramLines.erase(remove(tramLines.begin(), tramLines.end(), found->second), tramLines.end());
+        lineVersions.at(found->second) = bump();
+    }
+
+    void setTramStatus(shared_ptr <TramPrx> tram, TramStatus status) {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        string tramKey = key(tram->ice_getIdentity());
+        tramStatuses[tramKey] = status;
+        auto found = linesByTram.find(tramKey);
+        if (found == linesByTram.end()) {
+            return;
+        }
+        for (int lineId: found->second) {
+            for (auto &entry: lines.at(lineId).trams) {
+                if (entry.tram->ice_getIdentity() == tram->ice_getIdentity()) {
+                    entry.status = status;
+                }
+            }
+            lineVersions.at(lineId) = bump();
+        }
+    }
+
+    string getLineName(const Ice::Identity &line) {
+        shared_lock <shared_timed_mutex> lock(topologyMutex);
+        auto found = lineIds.find(key(line));
+        return found == lineIds.end() ? "" : lines.at(found->second).name;
+    }
+
+    // czeka, az wersja sieci przekroczy `sinceVersion`, minie `timeout` albo `interrupted()`
+    // zwroci true; zwraca aktualna wersje
+    template<typename Predicate>
+    Ice::Long waitForChange(Ice::Long sinceVersion, chrono::milliseconds timeout, Predicate interrupted) {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        topologyChanged.wait_for(lock, timeout, [&]() { return version > sinceVersion || interrupted(); });
+        return version;
+    }
+
+    // budzi czekajacych w waitForChange, np. zeby sprawdzili warunek zakonczenia
+    void wake() {
+        unique_lock <shared_timed_mutex> lock(topologyMutex);
+        topologyChanged.notify_all();
+    }
+
+    // sinceVersion == 0 zwraca pelny obraz sieci
+    NetworkSnapshot getChanges(Ice::Long sinceVersion) {
+        shared_lock <shared_timed_mutex> lock(topologyMutex);
+        NetworkSnapshot snapshot;
+        snapshot.version = version;
+        for (size_t i = 0; i < stops.size(); ++i) {
+            if (stopVersions.at(i) > sinceVersion) {
+                snapshot.stops.push_back(stops.at(i));
+            }
+        }
+        for (size_t i = 0; i < lines.size(); ++i) {
+            if (lineVersions.at(i) > sinceVersion) {
+                snapshot.lines.push_back(lines.at(i));
+            }
+        }
+        return snapshot;
+    }
+};
+
+// Pierscien spojnego haszowania przystankow po nazwie. Kazdy shard ma kilka wirtualnych punktow,
+// a nazwa nalezy do pierwszego punktu za jej haszem, wiec dolaczenie lub odejscie jednego shardu
+// zmienia wlasciciela tylko okolo 1/N nazw.
+class ShardRing {
+private:
+    static const int pointsPerShard = 64;
+    map <uint32_t, shared_ptr<StopFactoryPrx>> points;
+
+    // FNV-1a - ten sam wynik w kazdym procesie i na kazdej platformie
+    static uint32_t hash(const string &text) {
+        uint32_t value = 2166136261u;
+        for (unsigned char c: text) {
+            value ^= c;
+            value *= 16777619u;
+        }
+        return value;
+    }
+
+    static string key(const shared_ptr <StopFactoryPrx> &shard) {
+        return Ice::identityToString(shard->ice_getIdentity());
+    }
+
+public:
+    void add(shared_ptr <StopFactoryPrx> shard) {
+        for (int i = 0; i < pointsPerShard; ++i) {
+            points[hash(key(shard) + "#" + to_string(i))] = shard;
+        }
+    }
+
+    void remove(const shared_ptr <StopFactoryPrx> &shard) {
+        for (int i = 0; i < pointsPerShard; ++i) {
+            auto found = points.find(hash(key(shard) + "#" + to_string(i)));
+            if (found != points.end() && found->second->ice_getIdentity() == shard->ice_getIdentity()) {
+                points.erase(found);
+            }
+        }
+    }
+
+    bool contains(const shared_ptr <StopFactoryPrx> &shard) const {
+        auto found = points.find(hash(key(shard) + "#0"));
+        return found != points.end() && found->second->ice_getIdentity() == shard->ice_getIdentity();
+    }
+
+    shared_ptr <StopFactoryPrx> owner(const string &name) const {
+        if (points.empty()) {
+            return nullptr;
+        }
+        auto found = points.lower_bound(hash(name));
+        return found == points.end() ? points.begin()->second : found->second;
+    }
+
+    size_t size() const {
+        return points.size() / pointsPerShard;
+    }
+};
+
+// Wypycha zmiany obrazu sieci do obserwatorow (klientow pasazera), wiec nie musza odpytywac
+// getNetworkChanges. Zmiany sa zbierane przez `batchDelay`, a kazda paczka mowi, od ktorej wersji
+// zaczyna, zeby obserwator mogl wykryc zgubiona paczke. Obserwator, do ktorego nie da sie
+// dostarczyc zmian, jest usuwany. Destruktor czeka na watek wysylajacy i na odpowiedzi na
+// wszystkie wyslane paczki, bo ich callbacki uzywaja publishera.
+class NetworkPublisher {
+private:
+    shared_ptr <NetworkTopology> topology;
+    vector <shared_ptr<NetworkObserverPrx>> observers;
+    Ice::Long published = 0;
+    mutex publisherMutex;
+    // wyslane paczki bez odpowiedzi
+    size_t pending = 0;
+    condition_variable drained;
+    atomic<bool> stopping{false};
+    chrono::milliseconds batchDelay{100};
+    thread worker;
+
+    void callFinished() {
+        lock_guard <mutex> lock(publisherMutex);
+        if (--pending == 0) {
+            drained.notify_all();
+        }
+    }
+
+    void run() {
+        while (!stopping) {
+            Ice::Long current = topology->waitForChange(published, chrono::seconds(1), [this]() { return stopping.load(); });
+            if (stopping || current <= published) {
+                continue;
+            }
+            this_thread::sleep_for(batchDelay);
+            Ice::Long sinceVersion;
+            NetworkSnapshot changes;
+            vector <shared_ptr<NetworkObserverPrx>> currentObservers;
+            {
+                lock_guard <mutex> lock(publisherMutex);
+                sinceVersion = published;
+                if (observers.empty()) {
+                    // nikt nie slucha - roznice nie sa nawet liczone
+                    published = current;
+                    continue;
+                }
+                changes = topology->getChanges(published);
+                published = changes.version;
+                currentObservers = observers;
+                pending += currentObservers.size();
+            }
+            for (const auto &observer: currentObservers) {
+                observer->networkChangedAsync(sinceVersion, changes, [this]() { callFinished(); },
+                                              [this, observer](exception_ptr) {
+                                                  removeObserver(observer);
+                                                  callFinished();
+                                              });
+            }
+        }
+    }
+
+public:
+    explicit NetworkPublisher(shared_ptr <NetworkTopology> topology) : topology(topology) {
+        worker = thread([this]() { run(); });
+    }
+
+    ~NetworkPublisher() {
+        stopping = true;
+        topology->wake();
+        worker.join();
+        unique_lock <mutex> lock(publisherMutex);
+        drained.wait(lock, [this]() { return pending == 0; });
+    }
+
+    // Zwraca pelny obraz sieci; zmiany nowsze od niego dotra do obserwatora w kolejnych paczkach.
+    NetworkSnapshot addObserver(shared_ptr <NetworkObserverPrx> observer) {
+        lock_guard <mutex> lock(publisherMutex);
+        observers.push_back(observer);
+        return topology->getChanges(0);
+    }
+
+    void removeObserver(shared_ptr <NetworkObserverPrx> observer) {
+        lock_guard <mutex> lock(publisherMutex);
+        for (auto it = observers.begin(); it != observers.end(); ++it) {
+            if ((*it)->ice_getIdentity() == observer->ice_getIdentity()) {
+                observers.erase(it);
+                break;
+            }
+        }
+    }
+};
+
+// Obciazenia fabryk odczytane raz i dalej prowadzone lokalnie: kazdy wybor dolicza wybranej
+// fabryce jeden servant. Fabryki sa pytane ponownie (rownolegle, wiec kosztuje to jedno
+// opoznienie sieci) dopiero gdy odczyt jest starszy niz `maxAge` albo zmienil sie zbior fabryk,
+// wiec seria umieszczen przy wczytywaniu sieci nie pyta o obciazenie przy kazdym obiekcie.
+template<typename FactoryPrx>
+class FactoryLoads {
+private:
+    mutex loadsMutex;
+    vector <shared_ptr<FactoryPrx>> factories;
+    vector<double> loads;
+    chrono::steady_clock::time_point sampledAt;
+    chrono::milliseconds maxAge{1000};
+
+    // wywolywane bez blokady; fabryka, ktora nie odpowiada, dostaje nieskonczone obciazenie
+    static vector<double> sample(const vector <shared_ptr<FactoryPrx>> &factories) {
+        vector <future<double>> replies;
+        for (const auto &factory: factories) {
+            replies.push_back(factory->getLoadAsync());
+        }
+        vector<double> sampled;
+        for (auto &reply: replies) {
+            try {
+                sampled.push_back(reply.get());
+            } catch (const Ice::Exception &e) {
+                cerr << "Fabryka nie odpowiada: " << e.what() << endl;
+                sampled.push_back(numeric_limits<double>::infinity());
+            }
+        }
+        return sampled;
+    }
+
+    // wywolywane pod loadsMutex
+    bool current(const vector <shared_ptr<FactoryPrx>> &known, chrono::steady_clock::time_point now) const {
+        if (known.size() != factories.size() || now - sampledAt > maxAge) {
+            return false;
+        }
+        for (size_t i = 0; i < known.size(); ++i) {
+            if (known.at(i)->ice_getIdentity() != factories.at(i)->ice_getIdentity()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    // najmniej obciazona z `known` albo nullptr, gdy zadna nie odpowiada
+    shared_ptr <FactoryPrx> pick(const vector <shared_ptr<FactoryPrx>> &known) {
+        auto now = chrono::steady_clock::now();
+        unique_lock <mutex> lock(loadsMutex);
+        if (!current(known, now)) {
+            lock.unlock();
+            vector<double> sampled = sample(known);
+            lock.lock();
+            factories = known;
+            loads = move(sampled);
+            sampledAt = now;
+        }
+        size_t best = loads.size();
+        for (size_t i = 0; i < loads.size(); ++i) {
+            if (loads.at(i) < (best == loads.size() ? numeric_limits<double>::infinity() : loads.at(best))) {
+                best = i;
+            }
+        }
+        if (best == loads.size()) {
+            return nullptr;
+        }
+        loads.at(best) += 1;
+        return factories.at(best);
+    }
+};
+
+class MPK_I : public SIP::MPK {
+private:
+    // lista linii zmienia sie rzadko, wiec jest podmieniana w calosci (copy-on-write)
+    // i czytana bez blokady przez atomic_load
+    shared_ptr<const LineList> all_lines = make_shared<LineList>();
+    mutex linesMutex;
+    StopList all_stops;
+    DepoList all_depos;
+    // nazwy sa trzymane lokalnie, wiec wyszukiwanie nie wykonuje zadnych zdalnych wywolan
+    unordered_map <string, size_t> stopsByName;
+    unordered_map <string, size_t> deposByName;
+    unordered_map <string, size_t> deposByIdentity;
+    shared_timed_mutex stopsMutex;
+    shared_timed_mutex deposMutex;
+    vector <std::shared_ptr<LineFactoryPrx>> lineFactories;
+    vector <std::shared_ptr<StopFactoryPrx>> stopFactories;
+    mutex factoriesMutex;
+    FactoryLoads<LineFactoryPrx> lineLoads;
+    FactoryLoads<StopFactoryPrx> stopLoads;
+    // shardy przystankow i przystanki, ktore w nich utworzono; shardsMutex chroni tylko te mapy
+    // i nigdy nie jest trzymany w trakcie wywolan shardow, a migrationMutex porzadkuje
+    // przenoszenie przystankow po kolejnych zmianach czlonkostwa
+    ShardRing shardRing;
+    unordered_map <string, shared_ptr<StopFactoryPrx>> stopOwners;
+    mutex shardsMutex;
+    mutex migrationMutex;
+    shared_ptr <NetworkTopology> topology = make_shared<NetworkTopology>();
+    shared_ptr <IdDirectory> ids = make_shared<IdDirectory>(
+            [this](const shared_ptr <TramStopPrx> &stop) { return topology->resolveStopId(stop); },
+            [this](const shared_ptr <TramPrx> &tram) { return topology->getTramId(tram); });
+    shared_ptr <NetworkPublisher> publisher = make_shared<NetworkPublisher>(topology);
+
+    struct StopMove {
+        string name;
+        shared_ptr <StopFactoryPrx> from;
+        // pusty, gdy nie ma juz shardow - wtedy przystanek trafia do najmniej obciazonej fabryki
+        shared_ptr <StopFactoryPrx> to;
+    };
+
+    // wywolywane pod shardsMutex; tylko lokalnie ustala, ktore przystanki zmieniaja wlasciciela
+    vector <StopMove> planRebalance() {
+        vector <StopMove> moves;
+        for (auto it = stopOwners.begin(); it != stopOwners.end();) {
+            auto owner = shardRing.owner(it->first);
+            if (owner && owner->ice_getIdentity() == it->second->ice_getIdentity()) {
+                ++it;
+                continue;
+            }
+            moves.push_back(StopMove{it->first, it->second, owner});
+            if (owner) {
+                it->second = owner;
+                ++it;
+            } else {
+                it = stopOwners.erase(it);
+            }
+        }
+        return moves;
+    }
+
+    // Wywolywane pod migrationMutex, bez shardsMutex. Nowy przystanek przejmuje ruch zanim stary
+    // odda stan, wiec do nowego trafia wszystko, co stary zdazyl przyjac.
+    void migrateStops(const vector <StopMove> &moves) {
+        if (moves.empty()) {
+            return;
+        }
+        vector <shared_ptr<StopFactoryPrx>> factories;
+        {
+            lock_guard <mutex> lock(factoriesMutex);
+            factories = stopFactories;
+        }
+        unordered_map <string, shared_ptr<TramStopPrx>> moved;
+        for (const auto &stopMove: moves) {
+            auto target = stopMove.to ? stopMove.to : stopLoads.pick(factories);
+            shared_ptr <TramStopPrx> oldStop = getTramStop(stopMove.name, Ice::Current());
+            shared_ptr <TramStopPrx> newStop;
+            try {
+                if (target) {
+                    newStop = target->createStop(stopMove.name);
+                }
+            } catch (const Ice::Exception &e) {
+                cerr << "Fabryka nie utworzyla przystanku " << stopMove.name << ": " << e.what() << endl;
+            }
+            if (!newStop) {
+                cerr << "Brak fabryki dla przystanku " << stopMove.name << endl;
+                // przystanek zostaje u starego wlasciciela do nastepnej przebudowy
+                lock_guard <mutex> lock(shardsMutex);
+                stopOwners[stopMove.name] = stopMove.from;
+                continue;
+            }
+            {
+                unique_lock <shared_timed_mutex> lock(stopsMutex);
+                all_stops.at(stopsByName.at(stopMove.name)).stop = newStop;
+            }
+            topology->replaceStop(oldStop, newStop);
+            moved[Ice::identityToString(oldStop->ice_getIdentity())] = newStop;
+            try {
+                target->restoreStop(newStop, stopMove.from->saveStop(oldStop));
+            } catch (const Ice::Exception &e) {
+                // odchodzacy shard mogl juz zniknac - pasazerowie musza zasubskrybowac ponownie
+                cerr << "Stan przystanku " << stopMove.name << " nie zostal przeniesiony: " << e.what() << endl;
+            }
+            try {
+                stopMove.from->destroyStop(oldStop);
+            } catch (const Ice::Exception &) {
+                // odchodzacy shard mogl juz zniknac
+            }
+            cout << "Przystanek " << stopMove.name << " przeniesiony do innego shardu" << endl;
+        }
+        if (moved.empty()) {
+            return;
+        }
+        // linie dostaja nowe proxy, a zmiana wersji przystankow kaze tramwajom je pobrac
+        for (const auto &line: *atomic_load(&all_lines)) {
+            StopList stops = line->getStops();
+            bool changed = false;
+            for (auto &stopInfo: stops) {
+                auto found = moved.find(Ice::identityToString(stopInfo.stop->ice_getIdentity()));
+                if (found != moved.end()) {
+                    stopInfo.stop = found->second;
+                    changed = true;
+                }
+            }
+            if (changed) {
+                line->setStops(stops);
+            }
+        }
+    }
+public:
+    shared_ptr <NetworkTopology> getTopology() {
+        return topology;
+    }
+
+    shared_ptr <IdDirectory> getIds() {
+        return ids;
+    }
+
+    LineList getLines(const Ice::Current &current) override {
+        return *atomic_load(&all_lines);
+    };
+
+    void addStop(string name, shared_ptr <TramStopPrx> tramStop) {
+        unique_lock <shared_timed_mutex> lock(stopsMutex);
+        if (stopsByName.count(name)) {
+            return;
+        }
+        StopInfo stopInfo;
+        stopInfo.stop = tramStop;
+        stopsByName[name] = all_stops.size();
+        all_stops.push_back(stopInfo);
+        lock.unlock();
+        topology->addStop(name, tramStop);
+    }
+
+    void addLine(shared_ptr <LinePrx> line, const Ice::Current &current) override {
+        {
+            lock_guard <mutex> lock(linesMutex);
+            auto lines = make_shared<LineList>(*all_lines);
+            lines->push_back(line);
+            atomic_store(&all_lines, shared_ptr<const LineList>(lines));
+        }
+        // linia moze zyc w procesie innej fabryki, wiec jej przystanki trafiaja do obrazu sieci tutaj
+        topology->addLine(line->getName(), line);
+        topology->setLineStops(line->ice_getIdentity(), line->getStops());
+    }
+
+    void registerDepo(::std::shared_ptr <DepoPrx> depo, const Ice::Current &current) override {
+        string depoName = depo->getName();
+        string identity = Ice::identityToString(depo->ice_getIdentity());
+        unique_lock <shared_timed_mutex> lock(deposMutex);
+        if (deposByIdentity.count(identity)) {
+            return;
+        }
+        cout << "Nowa zajezdnia o nazwie: " << depoName << endl;
+        DepoInfo depoInfo;
+        depoInfo.stop = depo;
+        depoInfo.name = depoName;
+        deposByName[depoName] = all_depos.size();
+        deposByIdentity[identity] = all_depos.size();
+        all_depos.push_back(depoInfo);
+    }
+
+    void unregisterDepo(::std::shared_ptr <DepoPrx> depo, const Ice::Current &current) override {
+        unique_lock <shared_timed_mutex> lock(deposMutex);
+        auto found = deposByIdentity.find(Ice::identityToString(depo->ice_getIdentity()));
+        if (found == deposByIdentity.end()) {
+            return;
+        }
+        size_t index = found->second;
+        cout << "Usuwam zajezdnie o nazwie: " << all_depos.at(index).name << endl;
+        deposByName.erase(all_depos.at(index).name);
+        deposByIdentity.erase(found);
+
+        // ostatni wpis trafia na miejsce usunietego, dzieki czemu usuwanie jest O(1)
+        size_t last = all_depos.size() - 1;
+        if (index != last) {
+            all_depos.at(index) = all_depos.at(last);
+            deposByName[all_depos.at(index).name] = index;
+            deposByIdentity[Ice::identityToString(all_depos.at(index).stop->ice_getIdentity())] = index;
+        }
+        all_depos.pop_back();
+    };
+
+    // rejestr jest przebudowywany przy kazdej zmianie shardow, wiec zwraca przystanek
+    // w shardzie, ktory jest jego aktualnym wlascicielem
+    shared_ptr <TramStopPrx> getTramStop(string name, const Ice::Current &current) override {
+        shared_lock <shared_timed_mutex> lock(stopsMutex);
+        auto found = stopsByName.find(name);
+        if (found == stopsByName.end()) {
+            return nullptr;
+        }
+        return all_stops.at(found->second).stop;
+    }
+
+    shared_ptr <DepoPrx> getDepo(string name, const Ice::Current &current) override {
+        shared_lock <shared_timed_mutex> lock(deposMutex);
+        auto found = deposByName.find(name);
+        if (found == deposByName.end()) {
+            return nullptr;
+        }
+        return all_depos.at(found->second).stop;
+    }
+
+    DepoList getDepos(const Ice::Current &current) override {
+        shared_lock <shared_timed_mutex> lock(deposMutex);
+        return all_depos;
+    }
+
+    // shared_ptr porownuje wskazniki, a kazde wywolanie przynosi nowy obiekt proxy - fabryke
+    // rozpoznajemy po tozsamosci obiektu
+    template<typename FactoryPrx>
+    static typename vector<shared_ptr<FactoryPrx>>::iterator
+    findFactory(vector <shared_ptr<FactoryPrx>> &factories, const shared_ptr <FactoryPrx> &factory) {
+        return find_if(factories.begin(), factories.end(), [&factory](const shared_ptr <FactoryPrx> &known) {
+            return known->ice_getIdentity() == factory->ice_getIdentity();
+        });
+    }
+
+    NetworkSnapshot getNetwork(const Ice::Current &current) override {
+        return topology->getChanges(0);
+    }
+
+    NetworkSnapshot getNetworkChanges(Ice::Long sinceVersion, const Ice::Current &current) override {
+        return topology->getChanges(sinceVersion);
+    }
+
+    NetworkSnapshot addNetworkObserver(shared_ptr <NetworkObserverPrx> observer, const Ice::Current &current) override {
+        return publisher->addObserver(observer);
+    }
+
+    void removeNetworkObserver(shared_ptr <NetworkObserverPrx> observer, const Ice::Current &current) override {
+        publisher->removeObserver(observer);
+    }
+
+    int getStopId(shared_ptr <TramStopPrx> stop, const Ice::Current &current) override {
+        return ids->stopId(stop);
+    }
+
+    int getTramId(shared_ptr <TramPrx> tram, const Ice::Current &current) override {
+        return ids->tramId(tram);
+    }
+
+    // Tworzy linie w fabryce o najmniejszym obciazeniu (wedlug FactoryLoads). Fabryki, ktore nie
+    // odpowiadaja, sa pomijane; gdy zadna nie jest dostepna, zwraca nullptr.
+    shared_ptr <LinePrx> placeLine(string name) {
+        vector <shared_ptr<LineFactoryPrx>> factories;
+        {
+            lock_guard <mutex> lock(factoriesMutex);
+            factories = lineFactories;
+        }
+        auto factory = lineLoads.pick(factories);
+        if (!factory) {
+            return nullptr;
+        }
+        auto line = factory->createLine(name);
+        topology->addLine(name, line);
+        return line;
+    }
+
+    // Tworzy przystanki i od razu rejestruje je w MPK. Gdy sa shardy, przystanek trafia do shardu
+    // wskazanego przez pierscien, w przeciwnym razie do najmniej obciazonej fabryki. Przystanki
+    // jednej fabryki powstaja jednym wywolaniem createStops, a fabryki sa wolane rownolegle.
+    // Gdy fabryka nie odpowiada albo zadnej nie ma, na miejscu przystanku zostaje nullptr.
+    vector <shared_ptr<TramStopPrx>> placeStops(const vector <string> &names) {
+        vector <shared_ptr<StopFactoryPrx>> targets(names.size());
+        bool sharded;
+        {
+            lock_guard <mutex> lock(shardsMutex);
+            sharded = shardRing.size() > 0;
+            for (size_t i = 0; sharded && i < names.size(); ++i) {
+                targets.at(i) = shardRing.owner(names.at(i));
+            }
+        }
+        if (!sharded) {
+            vector <shared_ptr<StopFactoryPrx>> factories;
+            {
+                lock_guard <mutex> lock(factoriesMutex);
+                factories = stopFactories;
+            }
+            for (auto &target: targets) {
+                target = stopLoads.pick(factories);
+            }
+        }
+
+        // jedna paczka nazw na fabryke
+        vector <pair<shared_ptr<StopFactoryPrx>, vector<size_t>>> batches;
+        unordered_map <string, size_t> batchByFactory;
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (!targets.at(i)) {
+                continue;
+            }
+            auto inserted = batchByFactory.emplace(Ice::identityToString(targets.at(i)->ice_getIdentity()),
+                                                   batches.size());
+            if (inserted.second) {
+                batches.emplace_back(targets.at(i), vector<size_t>());
+            }
+            batches.at(inserted.first->second).second.push_back(i);
+        }
+        vector <future<TramStopList>> replies;
+        for (const auto &batch: batches) {
+            NameList batchNames;
+            for (size_t index: batch.second) {
+                batchNames.push_back(names.at(index));
+            }
+            replies.push_back(batch.first->createStopsAsync(batchNames));
+        }
+
+        vector <shared_ptr<TramStopPrx>> stops(names.size());
+        vector <pair<shared_ptr<StopFactoryPrx>, shared_ptr<TramStopPrx>>> misplaced;
+        vector <size_t> retried;
+        for (size_t b = 0; b < batches.size(); ++b) {
+            const auto &batch = batches.at(b);
+            TramStopList created;
+            try {
+                created = replies.at(b).get();
+            } catch (const Ice::Exception &e) {
+                cerr << "Fabryka nie utworzyla przystankow: " << e.what() << endl;
+                continue;
+            }
+            lock_guard <mutex> lock(shardsMutex);
+            for (size_t k = 0; k < batch.second.size() && k < created.size(); ++k) {
+                size_t index = batch.second.at(k);
+                const string &name = names.at(index);
+                if (sharded) {
+                    auto owner = shardRing.owner(name);
+                    if (!owner || owner->ice_getIdentity() != batch.first->ice_getIdentity()) {
+                        // pierscien zmienil sie w trakcie tworzenia - przystanek powstanie u nowego wlasciciela
+                        misplaced.emplace_back(batch.first, created.at(k));
+                        retried.push_back(index);
+                        continue;
+                    }
+                    stopOwners[name] = batch.first;
+                }
+                addStop(name, created.at(k));
+                stops.at(index) = created.at(k);
+            }
+        }
+
+        for (const auto &stop: misplaced) {
+            try {
+                stop.first->destroyStop(stop.second);
+            } catch (const Ice::Exception &) {
+            }
+        }
+        if (!retried.empty()) {
+            vector <string> retriedNames;
+            for (size_t index: retried) {
+                retriedNames.push_back(names.at(index));
+            }
+            auto placed = placeStops(retriedNames);
+            for (size_t i = 0; i < retried.size(); ++i) {
+                stops.at(retried.at(i)) = placed.at(i);
+            }
+        }
+        return stops;
+    }
+
+    shared_ptr <TramStopPrx> placeStop(string name) {
+        return placeStops({name}).front();
+    }
+
+    size_t getFactoriesCount() {
+        size_t shards;
+        {
+            lock_guard <mutex> lock(shardsMutex);
+            shards = shardRing.size();
+        }
+        lock_guard <mutex> lock(factoriesMutex);
+        return lineFactories.size() + stopFactories.size() + shards;
+    }
+
+    void registerLineFactory(std::shared_ptr <SIP::LineFactoryPrx> lf, const Ice::Current &current) override {
+        lock_guard <mutex> lock(factoriesMutex);
+        // Sprawdzenie, czy fabryka już jest zarejestrowana
+        if (findFactory(lineFactories, lf) == lineFactories.end()) {
+            lineFactories.push_back(lf);
+            std::cout << "Fabryka linii zarejestrowana." << std::endl;
+        }
+    }
+
+    void unregisterLineFactory(std::shared_ptr <SIP::LineFactoryPrx> lf, const Ice::Current &current) override {
+        lock_guard <mutex> lock(factoriesMutex);
+        auto it = findFactory(lineFactories, lf);
+        if (it != lineFactories.end()) {
+            lineFactories.erase(it);
+            std::cout << "LineFactory unregistered." << std::endl;
+        }
+    }
+
+    void registerStopFactory(std::shared_ptr <SIP::StopFactoryPrx> lf, const Ice::Current &current) override {
+        lock_guard <mutex> lock(factoriesMutex);
+        // Sprawdzenie, czy fabryka już jest zarejestrowana
+        if (findFactory(stopFactories, lf) == stopFactories.end()) {
+            stopFactories.push_back(lf);
+            std::cout << "StopFactory registered." << std::endl;
+        }
+    }
+
+    void unregisterStopFactory(std::shared_ptr <SIP::StopFactoryPrx> lf, const Ice::Current &current) override {
+        lock_guard <mutex> lock(factoriesMutex);
+        auto it = findFactory(stopFactories, lf);
+        if (it != stopFactories.end()) {
+            stopFactories.erase(it);
+            std::cout << "StopFactory unregistered." << std::endl;
+        }
+    }
+
+    // Nowy shard przejmuje z pozostalych te przystanki, ktore wskazuje mu pierscien.
+    void registerStopShard(std::shared_ptr <SIP::StopFactoryPrx> shard, const Ice::Current &current) override {
+        lock_guard <mutex> migration(migrationMutex);
+        vector <StopMove> moves;
+        {
+            lock_guard <mutex> lock(shardsMutex);
+            if (shardRing.contains(shard)) {
+                return;
+            }
+            shardRing.add(shard);
+            cout << "Shard przystankow zarejestrowany, liczba shardow: " << shardRing.size() << endl;
+            moves = planRebalance();
+        }
+        migrateStops(moves);
+    }
+
+    // Przystanki odchodzacego shardu sa odtwarzane u nowych wlascicieli razem ze stanem
+    // (tablica przyjazdow, subskrypcje, tramwaje na przystanku). Jesli shard juz nie odpowiada,
+    // stan przepada - tramwaje odbuduja tablice przy nastepnym przejezdzie, a pasazerowie
+    // musza zasubskrybowac ponownie.
+    void unregisterStopShard(std::shared_ptr <SIP::StopFactoryPrx> shard, const Ice::Current &current) override {
+        lock_guard <mutex> migration(migrationMutex);
+        vector <StopMove> moves;
+        {
+            lock_guard <mutex> lock(shardsMutex);
+            if (!shardRing.contains(shard)) {
+                return;
+            }
+            shardRing.remove(shard);
+            cout << "Shard przystankow wyrejestrowany, liczba shardow: " << shardRing.size() << endl;
+            moves = planRebalance();
+        }
+        migrateStops(moves);
+    }
+
+};
+
+// Tablica przyjazdow przystanku uporzadkowana po bezwzglednym czasie przyjazdu (minuty od epoki).
+// Kazdy tramwaj ma co najwyzej jeden wpis. Przyjazdy z przeszlosci sa usuwane przy zapisie,
+// a odczyt tylko je pomija, dzieki czemu moze isc rownolegle pod wspolna blokada.
+class ArrivalBoard {
+public:
+    struct Arrival {
+        TramInfo info;
+        int tramId;
+        string line;
+    };
+
+private:
+    multimap <Ice::Long, Arrival> arrivals;
+    unordered_map <string, multimap<Ice::Long, Arrival>::iterator> arrivalsByTram;
+
+    static Ice::Long nowMinutes() {
+        return static_cast<Ice::Long>(time(nullptr) / 60);
+    }
+
+    // Time niesie tylko godzine i minute, wiec przyjmujemy najblizsza (+-12h) chwile o tej porze
+    static Ice::Long toAbsolute(const Time &arrival, Ice::Long now) {
+        time_t nowSeconds = static_cast<time_t>(now * 60);
+        tm timeNow;
+        localtime_r(&nowSeconds, &timeNow);
+        int delta = arrival.hour * 60 + arrival.minute - (timeNow.tm_hour * 60 + timeNow.tm_min);
+        if (delta < -12 * 60) {
+            delta += 24 * 60;
+        } else if (delta > 12 * 60) {
+            delta -= 24 * 60;
+        }
+        return now + delta;
+    }
+
+    static string key(const shared_ptr <TramPrx> &tram) {
+        return Ice::identityToString(tram->ice_getIdentity());
+    }
+
+    void expire(Ice::Long now) {
+        while (!arrivals.empty() && arrivals.begin()->first < now) {
+            arrivalsByTram.erase(key(arrivals.begin()->second.info.tram));
+            arrivals.erase(arrivals.begin());
+        }
+    }
+
+public:
+    // zwraca, za ile minut tramwaj bedzie na przystanku, albo -1 gdy przyjazd juz minal
+    Ice::Long update(shared_ptr <TramPrx> tram, Time arrival, int tramId, string line = "") {
+        Ice::Long now = nowMinutes();
+        expire(now);
+        remove(tram);
+        TramInfo tramInfo;
+        tramInfo.tram = tram;
+        tramInfo.time = arrival;
+        Ice::Long at = toAbsolute(arrival, now);
+        if (at < now) {
+            return -1;
+        }
+        Arrival entry;
+        entry.info = tramInfo;
+        entry.tramId = tramId;
+        entry.line = move(line);
+        arrivalsByTram[key(tram)] = arrivals.emplace(at, entry);
+        return at - now;
+    }
+
+    // ktory z kolei jest przyjazd tramwaju; liczenie konczy sie na `limit`
+    int rank(const shared_ptr <TramPrx> &tram, int limit) {
+        auto found = arrivalsByTram.find(key(tram));
+        if (found == arrivalsByTram.end()) {
+            return limit;
+        }
+        int position = 0;
+        for (auto it = arrivals.lower_bound(nowMinutes()); it != found->second && position < limit; ++it) {
+            position++;
+        }
+        return position;
+    }
+
+    string lineOf(const shared_ptr <TramPrx> &tram) {
+        auto found = arrivalsByTram.find(key(tram));
+        return found == arrivalsByTram.end() ? "" : found->second->second.line;
+    }
+
+    vector <Arrival> upcoming() {
+        vector <Arrival> entries;
+        for (auto it = arrivals.lower_bound(nowMinutes()); it != arrivals.end(); ++it) {
+            entries.push_back(it->second);
+        }
+        return entries;
+    }
+
+    void remove(const shared_ptr <TramPrx> &tram) {
+        auto found = arrivalsByTram.find(key(tram));
+        if (found != arrivalsByTram.end()) {
+            arrivals.erase(found->second);
+            arrivalsByTram.erase(found);
+        }
+    }
+
+    TramList next(int howMany) {
+        TramList nextTrams;
+        for (auto it = arrivals.lower_bound(nowMinutes()); it != arrivals.end() && static_cast<int>(nextTrams.size()) < howMany; ++it) {
+            nextTrams.push_back(it->second.info);
+        }
+        return nextTrams;
+    }
+
+    TramTimeList nextIds(int howMany) {
+        TramTimeList nextTrams;
+        for (auto it = arrivals.lower_bound(nowMinutes()); it != arrivals.end() && static_cast<int>(nextTrams.size()) < howMany; ++it) {
+            TramTime tramTime;
+            tramTime.tram = it->second.tramId;
+            tramTime.minuteOfDay = minuteOfDay(it->second.info.time);
+            nextTrams.push_back(tramTime);
+        }
+        return nextTrams;
+    }
+
+    size_t size() {
+        return arrivals.size();
+    }
+};
+
+// Subskrypcje przystanku z filtrem sprawdzanym po stronie serwera. Indeks: linia -> limit k
+// najblizszych przyjazdow -> prog minut, wiec zdarzenie odwiedza tylko subskrypcje swojej linii
+// (i dowolnej linii), ktore obejmuja jego pozycje na tablicy i czas do przyjazdu.
+class SubscriptionIndex {
+public:
+    struct Subscription {
+        shared_ptr <PassengerPrx> passenger;
+        SubscriptionFilter filter;
+    };
+
+private:
+    using ByThreshold = multimap<int, Subscription>;
+
+    struct Bucket {
+        // subskrypcje bez limitu przyjazdow
+        ByThreshold unlimited;
+        // limit k -> subskrypcje "k najblizszych"; przyjazd o pozycji rank pasuje do limitow > rank
+        map <int, ByThreshold> byRank;
+
+        ByThreshold &thresholds(int nextArrivals) {
+            return nextArrivals > 0 ? byRank[nextArrivals] : unlimited;
+        }
+
+        bool empty() const {
+            return unlimited.empty() && byRank.empty();
+        }
+    };
+
+    struct Entry {
+        string line;
+        ByThreshold::iterator position;
+    };
+
+    // "" - subskrypcje bez filtra linii
+    unordered_map <string, Bucket> byLine;
+    unordered_map <string, vector<Entry>> byPassenger;
+    multiset<int> nextArrivalLimits;
+    size_t count = 0;
+
+    static string key(const shared_ptr <PassengerPrx> &passenger) {
+        return Ice::identityToString(passenger->ice_getIdentity());
+    }
+
+    static int threshold(const SubscriptionFilter &filter) {
+        return filter.withinMinutes > 0 ? filter.withinMinutes : numeric_limits<int>::max();
+    }
+
+    static void collect(const ByThreshold &thresholds, Ice::Long minutesAway,
+                        vector <shared_ptr<PassengerPrx>> &matched) {
+        for (auto it = thresholds.lower_bound(static_cast<int>(minutesAway)); it != thresholds.end(); ++it) {
+            matched.push_back(it->second.passenger);
+        }
+    }
+
+    void collect(const string &line, Ice::Long minutesAway, int rank, vector <shared_ptr<PassengerPrx>> &matched) {
+        auto bucket = byLine.find(line);
+        if (bucket == byLine.end()) {
+            return;
+        }
+        collect(bucket->second.unlimited, minutesAway, matched);
+        for (auto it = bucket->second.byRank.upper_bound(rank); it != bucket->second.byRank.end(); ++it) {
+            collect(it->second, minutesAway, matched);
+        }
+    }
+
+public:
+    // powtorzona linia w filtrze dawalaby podwojne powiadomienia, wiec linie sa zapamietywane bez powtorzen
+    void add(shared_ptr <PassengerPrx> passenger, SubscriptionFilter filter) {
+        remove(passenger);
+        sort(filter.lines.begin(), filter.lines.end());
+        filter.lines.erase(unique(filter.lines.begin(), filter.lines.end()), filter.lines.end());
+        Subscription subscription;
+        subscription.passenger = passenger;
+        subscription.filter = filter;
+        auto &entries = byPassenger[key(passenger)];
+        if (filter.lines.empty()) {
+            auto &thresholds = byLine[""].thresholds(filter.nextArrivals);
+            entries.push_back(Entry{"", thresholds.emplace(threshold(filter), subscription)});
+        }
+        for (const auto &line: filter.lines) {
+            auto &thresholds = byLine[line].thresholds(filter.nextArrivals);
+            entries.push_back(Entry{line, thresholds.emplace(threshold(filter), subscription)});
+        }
+        if (filter.nextArrivals > 0) {
+            nextArrivalLimits.insert(filter.nextArrivals);
+        }
+        count++;
+    }
+
+    bool remove(const shared_ptr <PassengerPrx> &passenger) {
+        return remove(passenger->ice_getIdentity());
+    }
+
+    bool remove(const Ice::Identity &passenger) {
+        auto found = byPassenger.find(Ice::identityToString(passenger));
+        if (found == byPassenger.end()) {
+            return false;
+        }
+        int nextArrivals = found->second.front().position->second.filter.nextArrivals;
+        if (nextArrivals > 0) {
+            nextArrivalLimits.erase(nextArrivalLimits.find(nextArrivals));
+        }
+        for (auto &entry: found->second) {
+            auto &bucket = byLine[entry.line];
+            auto &thresholds = bucket.thresholds(nextArrivals);
+            thresholds.erase(entry.position);
+            if (thresholds.empty() && nextArrivals > 0) {
+                bucket.byRank.erase(nextArrivals);
+            }
+            if (bucket.empty()) {
+                byLine.erase(entry.line);
+            }
+        }
+        byPassenger.erase(found);
+        count--;
+        return true;
+    }
+
+    // pasazerowie zainteresowani przyjazdem tramwaju danej linii za `minutesAway` minut,
+    // ktory jest `rank`-tym z kolei przyjazdem na przystanku
+    vector <shared_ptr<PassengerPrx>> match(const string &line, Ice::Long minutesAway, int rank) {
+        vector <shared_ptr<PassengerPrx>> matched;
+        if (!line.empty()) {
+            collect(line, minutesAway, rank, matched);
+        }
+        collect("", minutesAway, rank, matched);
+        return matched;
+    }
+
+    // najwieksze k sposrod subskrypcji "k najblizszych przyjazdow" - dalej nie trzeba liczyc pozycji
+    int rankLimit() const {
+        return nextArrivalLimits.empty() ? 0 : *nextArrivalLimits.rbegin();
+    }
+
+    vector <Subscription> all() {
+        vector <Subscription> subscriptions;
+        for (const auto &passenger: byPassenger) {
+            subscriptions.push_back(passenger.second.front().position->second);
+        }
+        return subscriptions;
+    }
+
+    size_t size() const {
+        return count;
+    }
+};
+
+// Kursory stronicowania. Pierwsza strona (cursor == 0) zapamietuje migawke calego wyniku,
+// a kolejne sa z niej wycinane, wiec strony sa rozlaczne i spojne, nawet gdy wynik
+// w miedzyczasie sie zmienia. Zwrocony kursor 0 oznacza ostatnia strone. Migawka wygasa
+// `ttl` po ostatnim uzyciu; dopiero gdy mimo to jest `capacity` otwartych kursorow, usuwany
+// jest najdawniej uzywany, a nie najstarszy, zeby nie zrywac czytanych wlasnie stron.
+template<typename List>
+class CursorTable {
+private:
+    struct Cursor {
+        shared_ptr<const List> snapshot;
+        size_t offset;
+        chrono::steady_clock::time_point lastUsed;
+    };
+
+    mutex cursorsMutex;
+    map <Ice::Long, Cursor> cursors;
+    Ice::Long nextCursor = 1;
+    size_t capacity;
+    chrono::seconds ttl;
+
+    // wywolywane pod cursorsMutex
+    void expire(chrono::steady_clock::time_point now) {
+        for (auto it = cursors.begin(); it != cursors.end();) {
+            if (now - it->second.lastUsed > ttl) {
+                it = cursors.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        while (cursors.size() >= capacity && !cursors.empty()) {
+            cursors.erase(min_element(cursors.begin(), cursors.end(), [](const pair<const Ice::Long, Cursor> &a,
+                                                                         const pair<const Ice::Long, Cursor> &b) {
+                return a.second.lastUsed < b.second.lastUsed;
+            }));
+        }
+    }
+
+    static List slice(const List &all, size_t offset, size_t pageSize) {
+        size_t end = min(all.size(), offset + pageSize);
+        return List(all.begin() + offset, all.begin() + end);
+    }
+
+public:
+    explicit CursorTable(size_t capacity = 256, chrono::seconds ttl = chrono::seconds(60))
+            : capacity(capacity), ttl(ttl) {}
+
+    // Zapisuje do `page` kolejna strone i zwraca kursor nastepnej. `snapshot()` jest wolane
+    // tylko dla pierwszej strony. Nieznany lub wygasly kursor konczy sie CursorExpiredException.
+    template<typename Snapshot>
+    Ice::Long page(Ice::Long cursor, int pageSize, List &page, Snapshot snapshot) {
+        size_t size = static_cast<size_t>(max(pageSize, 1));
+        if (cursor == 0) {
+            auto all = make_shared<const List>(snapshot());
+            page = slice(*all, 0, size);
+            if (all->size() <= size) {
+                // caly wynik miesci sie na jednej stronie - nie ma czego zapamietywac
+                return 0;
+            }
+            auto now = chrono::steady_clock::now();
+            lock_guard <mutex> lock(cursorsMutex);
+            expire(now);
+            Ice::Long id = nextCursor++;
+            cursors[id] = Cursor{all, size, now};
+            return id;
+        }
+        lock_guard <mutex> lock(cursorsMutex);
+        auto found = cursors.find(cursor);
+        if (found == cursors.end()) {
+            throw CursorExpiredException();
+        }
+        Cursor &open = found->second;
+        page = slice(*open.snapshot, open.offset, size);
+        open.offset += page.size();
+        open.lastUsed = chrono::steady_clock::now();
+        if (open.offset >= open.snapshot->size()) {
+            cursors.erase(found);
+            return 0;
+        }
+        return cursor;
+    }
+};
+
+// Stan przystanku, ktory zostaje w pamieci po wyeksmitowaniu jego servanta
+struct StopState {
+    vector <shared_ptr<PassengerPrx>> passengers;
+    vector <SubscriptionIndex::Subscription> subscriptions;
+    vector <ArrivalBoard::Arrival> arrivals;
+    TramList currentTrams;
+
+    bool empty() const {
+        return passengers.empty() && subscriptions.empty() && arrivals.empty() && currentTrams.empty();
+    }
+
+    // dopisuje stan z innego zrodla; powtorzenia usuwa dopiero restoreState
+    void append(StopState other) {
+        move(other.passengers.begin(), other.passengers.end(), back_inserter(passengers));
+        move(other.subscriptions.begin(), other.subscriptions.end(), back_inserter(subscriptions));
+        move(other.arrivals.begin(), other.arrivals.end(), back_inserter(arrivals));
+        move(other.currentTrams.begin(), other.currentTrams.end(), back_inserter(currentTrams));
+    }
+
+    // postac przesylana miedzy shardami przy przenoszeniu przystanku
+    StopSnapshot toSnapshot() const {
+        StopSnapshot snapshot;
+        snapshot.passengers = passengers;
+        for (const auto &subscription: subscriptions) {
+            snapshot.subscriptions.push_back(SubscriptionEntry{subscription.passenger, subscription.filter});
+        }
+        for (const auto &arrival: arrivals) {
+            snapshot.arrivals.push_back(ArrivalEntry{arrival.info, arrival.tramId, arrival.line});
+        }
+        snapshot.currentTrams = currentTrams;
+        return snapshot;
+    }
+
+    static StopState fromSnapshot(StopSnapshot snapshot) {
+        StopState state;
+        state.passengers = move(snapshot.passengers);
+        for (auto &entry: snapshot.subscriptions) {
+            state.subscriptions.push_back(SubscriptionIndex::Subscription{entry.passenger, move(entry.filter)});
+        }
+        for (auto &entry: snapshot.arrivals) {
+            state.arrivals.push_back(ArrivalBoard::Arrival{entry.info, entry.tramId, move(entry.line)});
+        }
+        state.currentTrams = move(snapshot.currentTrams);
+        return state;
+    }
+};
+
+class TramStopI : public SIP::TramStop, public PassengerOwner {
+private:
+    string name;
+    LineList lines;
+    IdentitySet <shared_ptr<PassengerPrx>> passengers;
+    ArrivalBoard coming_trams;
+    SubscriptionIndex subscriptions;
+    IdentitySet <TramInfo> currentTrams;
+    CursorTable<TramTimeList> arrivalCursors;
+    shared_ptr <NotificationEngine> notifier;
+    shared_ptr <IdDirectory> ids;
+    shared_timed_mutex stopMutex;
+    Ice::Long knownDead = 0;
+
+    // wywolywane pod blokada zapisu; martwi pasazerowie znikaja z obu list subskrypcji
+    void pruneDead() {
+        Ice::Long dead = notifier->deadCount();
+        if (dead == knownDead) {
+            return;
+        }
+        knownDead = dead;
+        size_t pruned = notifier->dropDead(passengers);
+        for (const auto &subscription: subscriptions.all()) {
+            if (notifier->isDead(subscription.passenger) && subscriptions.remove(subscription.passenger)) {
+                pruned++;
+            }
+        }
+        if (pruned > 0) {
+            MPK_LOG(LogLevel::Info, "Przystanek " << name << " usunal niedostepnych pasazerow: " << pruned);
+        }
+    }
+
+public:
+    TramStopI(string name, shared_ptr <NotificationEngine> notifier, shared_ptr <IdDirectory> ids)
+            : notifier(notifier), ids(ids) {
+        this->name = name;
+    }
+
+    void addLine(::std::shared_ptr <LinePrx> line) {
+        unique_lock <shared_timed_mutex> lock(stopMutex);
+        lines.push_back(line);
+    }
+
+    StopState saveState() {
+        shared_lock <shared_timed_mutex> lock(stopMutex);
+        StopState state;
+        state.passengers = passengers.all();
+        state.subscriptions = subscriptions.all();
+        state.arrivals = coming_trams.upcoming();
+        state.currentTrams = currentTrams.all();
+        return state;
+    }
+
+    // Przyjazdy, ktore w miedzyczasie minely, sa pomijane przez ArrivalBoard. Stan jest dokladany
+    // do biezacego, bo przystanek przeniesiony do innego shardu mogl juz przyjac nowe wywolania.
+    void restoreState(StopState state) {
+        vector <shared_ptr<PassengerPrx>> restored = state.passengers;
+        {
+            unique_lock <shared_timed_mutex> lock(stopMutex);
+            for (auto &passenger: state.passengers) {
+                passengers.add(move(passenger));
+            }
+            for (const auto &subscription: state.subscriptions) {
+                subscriptions.add(subscription.passenger, subscription.filter);
+                restored.push_back(subscription.passenger);
+            }
+            for (const auto &arrival: state.arrivals) {
+                coming_trams.update(arrival.info.tram, arrival.info.time, arrival.tramId, arrival.line);
+            }
+            for (auto &tramInfo: state.currentTrams) {
+                currentTrams.add(move(tramInfo));
+            }
+        }
+        // nowy servant przejmuje pasazerow - silnik ma go wolac, gdy ktorys umrze
+        for (const auto &passenger: restored) {
+            notifier->subscribed(passenger, PassengerOwner::shared_from_this());
+        }
+    }
+
+    void dropPassenger(const Ice::Identity &passenger) override {
+        unique_lock <shared_timed_mutex> lock(stopMutex);
+        bool removed = passengers.remove(passenger);
+        removed = subscriptions.remove(passenger) || removed;
+        if (removed) {
+            MPK_LOG(LogLevel::Debug, "Przystanek " << name << " usunal niedostepnego pasazera "
+                    << Ice::identityToString(passenger));
+        }
+    }
+
+    string getName(const Ice::Current &current) override {
+        return name;
+    };
+
+    TramList getNextTrams(int howMany, const Ice::Current &current) override {
+        shared_lock <shared_timed_mutex> lock(stopMutex);
+        return coming_trams.next(howMany);
+//            TramList nextTrams;
+//            for(int i = 0; i < lines.size(); ++i){
+//
+//                TramList tramList = lines.at(i)->getTrams();
+//                int numberOfAllStops = lines.at(i)->getStops().size();
+//                for(int j = 0; j < tramList.size(); ++j){
+//
+//                    for(int k = 1; k < numberOfAllStops; ++k){
+//
+//                        StopList stopList = tramList.at(j).tram->getNextStops(k);
+//                        for(int l = 0; l < stopList.size(); ++l){
+//
+//                            if(stopList.at(l).stop->getName() == name){
+//                                TramInfo tramInfo;
+//                                tramInfo.tram = tramList.at(j).tram;
+//                                nextTrams.push_back(tramInfo);
+//                            }
+//                        }
+//                    }
+//                }
+//            }
+//            TramList resultTramList;
+//            for(int i = 0; i < howMany; i++){
+//                resultTramList.push_back(nextTrams.at(i));
+//            }
+//            return resultTramList;
+    };
+
+    TramTimeList getNextTramIds(int howMany, const Ice::Current &current) override {
+        shared_lock <shared_timed_mutex> lock(stopMutex);
+        return coming_trams.nextIds(howMany);
+    }
+
+    // kolejne strony tablicy przyjazdow z jednej migawki; kursory nie przetrwaja eksmisji przystanku
+    TramTimePage getNextTramPage(Ice::Long cursor, int pageSize, const Ice::Current &current) override {
+        TramTimePage page;
+        page.cursor = arrivalCursors.page(cursor, pageSize, page.trams, [this]() {
+            shared_lock <shared_timed_mutex> lock(stopMutex);
+            return coming_trams.nextIds(numeric_limits<int>::max());
+        });
+        return page;
+    }
+
+    void RegisterPassenger(::std::shared_ptr <PassengerPrx> passenger, const Ice::Current &current) override {
+        // pasazer wracajacy po awarii znow dostaje powiadomienia
+        notifier->revive(passenger);
+        size_t subscribed;
+        {
+            unique_lock <shared_timed_mutex> lock(stopMutex);
+            pruneDead();
+            // ponowna subskrypcja (np. po ponownym polaczeniu) nie podwaja powiadomien
+            passengers.add(passenger);
+            subscribed = passengers.size();
+        }
+        notifier->subscribed(passenger, PassengerOwner::shared_from_this());
+        MPK_LOG(LogLevel::Debug, "Pasazer zasubskrybowal przystanek: " << name
+                << "\nLiczba zasubskrybowanych pasażerów: " << subscribed);
+//            for(int lineIndex = 0; lineIndex < lines.size(); lineIndex++){
+//                shared_ptr<LinePrx> line = lines.at(lineIndex);
+//                TramList trams = line->getTrams();
+//                for(int tramIndex = 0; tramIndex < trams.size(); tramIndex++){
+//                    shared_ptr<TramPrx> tram = trams.at(tramIndex).tram;
+//                    tram->RegisterPassenger(passenger);
+//                }
+//            }
+    };
+
+    // pasazer dostaje tylko przyjazdy pasujace do filtra: wybrane linie, k najblizszych
+    // przyjazdow albo przyjazdy w ciagu N minut (zero oznacza brak danego ograniczenia)
+    void RegisterFilteredPassenger(shared_ptr <PassengerPrx> passenger, SubscriptionFilter filter,
+                                   const Ice::Current &current) override {
+        notifier->revive(passenger);
+        size_t subscribed;
+        {
+            unique_lock <shared_timed_mutex> lock(stopMutex);
+            pruneDead();
+            subscriptions.add(passenger, filter);
+            subscribed = subscriptions.size();
+        }
+        notifier->subscribed(passenger, PassengerOwner::shared_from_this());
+        MPK_LOG(LogLevel::Debug, "Pasazer zasubskrybowal przystanek z filtrem: " << name
+                << "\nLiczba subskrypcji z filtrem: " << subscribed);
+    }
+
+    void UnregisterPassenger(::std::shared_ptr <PassengerPrx> passenger, const Ice::Current &current) override {
+        {
+            unique_lock <shared_timed_mutex> lock(stopMutex);
+            if (subscriptions.remove(passenger)) {
+                MPK_LOG(LogLevel::Debug, "Pasazer odsubskrybowal przystanek: " << name);
+            }
+            if (passengers.remove(passenger->ice_getIdentity())) {
+                MPK_LOG(LogLevel::Debug, "Pasazer odsubskrybowal przystanek: " << name);
+            }
+        }
+        notifier->unsubscribed(passenger, PassengerOwner::shared_from_this());
+    };
+
+    void UpdateTramInfo(std::shared_ptr <SIP::TramPrx> tram, SIP::Time time, const Ice::Current &current) override {
+        updateArrival(tram, "", time);
+    };
+
+    void UpdateLineTramInfo(shared_ptr <TramPrx> tram, string line, Time time, const Ice::Current &current) override {
+        updateArrival(tram, line, time);
+    }
+
+    void updateArrival(shared_ptr <TramPrx> tram, string line, Time time) {
+        // id tramwaju znane z wczesniejszych przyjazdow nie kosztuje zadnego wywolania
+        int tramId = ids->tramId(tram);
+        vector <shared_ptr<PassengerPrx>> matched;
+        {
+            unique_lock <shared_timed_mutex> lock(stopMutex);
+            pruneDead();
+            Ice::Long minutesAway = coming_trams.update(tram, time, tramId, line);
+            if (minutesAway < 0 || subscriptions.size() == 0) {
+                return;
+            }
+            matched = subscriptions.match(line, minutesAway, coming_trams.rank(tram, subscriptions.rankLimit()));
+        }
+        string info = "Tramwaj linii " + (line.empty() ? string("?") : line) + " bedzie na przystanku " + name
+                      + " o " + to_string(time.hour) + ":" + (time.minute < 10 ? "0" : "") + to_string(time.minute);
+        // kolejne zmiany czasu tego samego tramwaju zastepuja sie w kolejce pasazera
+        notifier->publish(matched, "stop/" + name + "/" + Ice::identityToString(tram->ice_getIdentity()), info);
+    }
+
+    void addCurrentTram(shared_ptr <SIP::TramPrx> tram, const Ice::Current &current) override {
+        // zdarzenie przyjazdu sledzone od tramwaju (kontekst wywolania)
+        TraceEvent trace = TraceEvent::fromContext(current.ctx);
+        Ice::Long receivedAt = trace.traced() ? nowMicros() : 0;
+        TramInfo tramInfo;
+        tramInfo.tram = tram;
+        TramList trams;
+        vector <shared_ptr<PassengerPrx>> subscribers;
+        vector <shared_ptr<PassengerPrx>> matched;
+        string line;
+        {
+            unique_lock <shared_timed_mutex> lock(stopMutex);
+            pruneDead();
+            currentTrams.add(tramInfo);
+            trams = currentTrams.all();
+            subscribers = passengers.all();
+            if (subscriptions.size() > 0) {
+                // tramwaj na przystanku to przyjazd za 0 minut i pierwszy w kolejce
+                line = coming_trams.lineOf(tram);
+                matched = subscriptions.match(line, 0, 0);
+            }
+        }
+        if (!matched.empty()) {
+            notifier->publish(matched, "stop/" + name + "/" + Ice::identityToString(tram->ice_getIdentity()),
+                              "Tramwaj linii " + (line.empty() ? string("?") : line) + " dojechal do przystanku " + name,
+                              trace, name);
+        }
+        // numery taborowe z pamieci procesu; zdalnie tylko przy pierwszym przyjezdzie tramwaju
+        string info = "Tramwaje na przystanku " + name;
+        for (auto it = trams.begin(); it != trams.end(); ++it) {
+            try {
+                info += "\nTramwaj: " + ids->stockNumber(it->tram);
+            } catch (const Ice::Exception &) {
+                info += "\nTramwaj: ?";
+            }
+        }
+        MPK_LOG(LogLevel::Debug, info << "\nLiczba zasubskrybowanych pasażerów: " << subscribers.size());
+        // cala tablica przystanku to jedno powiadomienie, wiec pasazer, ktory nie nadaza, dostaje tylko najnowsza
+        notifier->publish(subscribers, "stop/" + name, info, trace, name);
+        tracer().span(trace, "stop.addCurrentTram", name, receivedAt, nowMicros());
+    }
+
+    void removeCurrentTram(shared_ptr <SIP::TramPrx> tram, const Ice::Current &current) override {
+        unique_lock <shared_timed_mutex> lock(stopMutex);
+        currentTrams.remove(tram->ice_getIdentity());
+    }
+
+};
+
+class LineI : public SIP::Line {
+private:
+    struct PublishedTime {
+        short minuteOfDay;
+        time_t publishedAt;
+    };
+
+    TramList all_trams;
+    StopList all_stops;
+    // ostatnio ogloszony rozklad kazdego tramwaju: tramwaj -> przystanek -> czas
+    unordered_map <string, unordered_map<string, PublishedTime>> timetables;
+    Ice::Long stopsVersion = 0;
+    string name;
+    shared_ptr <NetworkTopology> topology;
+    shared_ptr <IdDirectory> ids;
+    CursorTable<TramList> tramCursors;
+    shared_timed_mutex lineMutex;
+public:
+    LineI(string name, shared_ptr <NetworkTopology> topology, shared_ptr <IdDirectory> ids)
+            : topology(topology), ids(ids) {
+        this->name = name;
+    }
+
+    TramList getTrams(const Ice::Current &current) override {
+        shared_lock <shared_timed_mutex> lock(lineMutex);
+        return all_trams;
+    };
+
+    TramPage getTramPage(Ice::Long cursor, int pageSize, const Ice::Current &current) override {
+        TramPage page;
+        page.cursor = tramCursors.page(cursor, pageSize, page.trams, [this]() {
+            shared_lock <shared_timed_mutex> lock(lineMutex);
+            return all_trams;
+        });
+        return page;
+    }
+
+    SIP::StopList getStops(const Ice::Current &current) override {
+        shared_lock <shared_timed_mutex> lock(lineMutex);
+        return all_stops;
+    };
+
+    TramTimeList getTramIds(const Ice::Current &current) override {
+        TramList trams = getTrams(current);
+        TramTimeList tramIds;
+        for (const auto &tramInfo: trams) {
+            TramTime tramTime;
+            tramTime.tram = ids->tramId(tramInfo.tram);
+            tramTime.minuteOfDay = minuteOfDay(tramInfo.time);
+            tramIds.push_back(tramTime);
+        }
+        return tramIds;
+    }
+
+    StopTimeList getStopIds(const Ice::Current &current) override {
+        StopList stops = getStops(current);
+        StopTimeList stopIds;
+        for (const auto &stopInfo: stops) {
+            StopTime stopTime;
+            stopTime.stop = ids->stopId(stopInfo.stop);
+            stopTime.minuteOfDay = minuteOfDay(stopInfo.time);
+            stopIds.push_back(stopTime);
+        }
+        return stopIds;
+    }
+
+    string getName(const Ice::Current &current) override {
+        return name;
+    };
+
+    void registerTram(shared_ptr <TramPrx> tram, const Ice::Current &current) override {
+        TramInfo tramInfo;
+        tramInfo.tram = tram;
+        string stockNumber = tram->getStockNumber();
+        {
+            unique_lock <shared_timed_mutex> lock(lineMutex);
+            all_trams.push_back(tramInfo);
+        }
+
+        if (topology) {
+            topology->addTram(current.id, stockNumber, tram);
+        }
+        MPK_LOG(LogLevel::Info, "Nowy tramwaj o numerze: " << stockNumber << " zostal dodany");
+    };
+
+    void unregisterTram(::std::shared_ptr <TramPrx> tram, const Ice::Current &current) override {
+        bool removed = false;
+        {
+            unique_lock <shared_timed_mutex> lock(lineMutex);
+            for (auto it = all_trams.begin(); it != all_trams.end(); ++it) {
+                if (it->tram->ice_getIdentity() == tram->ice_getIdentity()) {
+                    all_trams.erase(it);
+                    removed = true;
+                    break;
+                }
+            }
+        }
+        if (removed) {
+            if (topology) {
+                topology->removeTram(current.id, tram);
+            }
+            {
+                unique_lock <shared_timed_mutex> lock(lineMutex);
+                timetables.erase(Ice::identityToString(tram->ice_getIdentity()));
+            }
+            string stockNumber = tram->getStockNumber();
+            MPK_LOG(LogLevel::Info, "Zjezdza z lini tramwaj o numerze: " << stockNumber
+                    << "\nOczekiwanie na offline" << stockNumber);
+        }
+    };
+
+    // Rozklad tramwaju trafia na tablice przystankow paczkami wywolan jednokierunkowych
+    // (batch oneway) - jedna paczka na polaczenie, czyli na proces przystankow. Wysylane sa tylko czasy, ktore zmienily sie
+    // od poprzedniego ogloszenia; wpis starszy niz 12h jest wysylany ponownie, bo Time nie niesie daty.
+    void publishTimetable(shared_ptr <TramPrx> tram, StopList timetable, const Ice::Current &current) override {
+        time_t now = time(nullptr);
+        StopList changed;
+        {
+            unique_lock <shared_timed_mutex> lock(lineMutex);
+            auto &published = timetables[Ice::identityToString(tram->ice_getIdentity())];
+            for (const auto &stopInfo: timetable) {
+                PublishedTime &entry = published[Ice::identityToString(stopInfo.stop->ice_getIdentity())];
+                short minute = minuteOfDay(stopInfo.time);
+                if (entry.publishedAt != 0 && entry.minuteOfDay == minute && now - entry.publishedAt < 12 * 3600) {
+                    continue;
+                }
+                entry.minuteOfDay = minute;
+                entry.publishedAt = now;
+                changed.push_back(stopInfo);
+            }
+        }
+        if (changed.empty()) {
+            return;
+        }
+        // Zwykle proxy batch oneway ma wlasna kolejke, ktorej flushBatchRequests komunikatora nie
+        // wysyla. Proxy przywiazane (ice_fixed) do polaczenia kolejkuja w kolejce polaczenia, wiec
+        // wszystkie przystanki jednego procesu dostaja swoje wpisy w jednej wiadomosci.
+        vector <Ice::ConnectionPtr> connections;
+        for (const auto &stopInfo: changed) {
+            try {
+                Ice::ConnectionPtr connection = stopInfo.stop->ice_getConnection();
+                if (!connection) {
+                    // przystanek w tym samym komunikatorze - wywolanie kolokowane, bez paczki
+                    stopInfo.stop->ice_oneway()->UpdateLineTramInfoAsync(tram, name, stopInfo.time, nullptr,
+                                                                         [](exception_ptr) {});
+                    continue;
+                }
+                stopInfo.stop->ice_fixed(connection)->ice_batchOneway()->UpdateLineTramInfo(tram, name,
+                                                                                            stopInfo.time);
+                if (find(connections.begin(), connections.end(), connection) == connections.end()) {
+                    connections.push_back(connection);
+                }
+            } catch (const Ice::Exception &ex) {
+                MPK_LOG(LogLevel::Error, "Linia " << name << ": przystanek niedostepny dla rozkladu: " << ex.what());
+            }
+        }
+        for (const auto &connection: connections) {
+            connection->flushBatchRequestsAsync(Ice::CompressBatch::BasedOnProxy, [](exception_ptr) {});
+        }
+    }
+
+    Ice::Long getStopsVersion(const Ice::Current &current) override {
+        shared_lock <shared_timed_mutex> lock(lineMutex);
+        return stopsVersion;
+    }
+
+    void setStops(SIP::StopList sl, const Ice::Current &current) override {
+        unique_lock <shared_timed_mutex> lock(lineMutex);
+        bool changed = sl.size() != all_stops.size();
+        for (size_t i = 0; !changed && i < sl.size(); ++i) {
+            changed = sl.at(i).stop->ice_getIdentity() != all_stops.at(i).stop->ice_getIdentity();
+        }
+        all_stops = sl;
+        if (changed) {
+            // tramwaje pobieraja liste przystankow ponownie tylko gdy zmieni sie ta wersja
+            stopsVersion++;
+        }
+        lock.unlock();
+        if (topology) {
+            topology->setLineStops(current.id, sl);
+        }
+    }
+
+};
+
+class DepoI : public SIP::Depo, public enable_shared_from_this<DepoI> {
+private:
+    string name;
+    TramList all_trams;
+    shared_ptr <NetworkTopology> topology;
+    // autorytatywny stan floty: kazda zmiana statusu zlecona przez zajezdnie trafia tutaj
+    unordered_map <string, FleetEntry> fleet;
+    vector <shared_ptr<DepoObserverPrx>> observers;
+    mutex depoMutex;
+
+    static string key(const shared_ptr <TramPrx> &tram) {
+        return Ice::identityToString(tram->ice_getIdentity());
+    }
+
+    // kazda zmiana statusu jest wypychana do obserwatorow asynchronicznie, wiec nikt nie musi odpytywac
+    // tramwajow; obserwator, do ktorego nie da sie dostarczyc zdarzenia, jest usuwany
+    void statusChanged(shared_ptr <TramPrx> tram, TramStatus status) {
+        topology->setTramStatus(tram, status);
+        string stockNumber;
+        vector <shared_ptr<DepoObserverPrx>> currentObservers;
+        {
+            lock_guard <mutex> lock(depoMutex);
+            auto found = fleet.find(key(tram));
+            if (found != fleet.end()) {
+                found->second.status = status;
+                stockNumber = found->second.stockNumber;
+            }
+            currentObservers = observers;
+        }
+        // odpowiedz moze przyjsc juz po zniszczeniu zajezdni
+        weak_ptr <DepoI> self = shared_from_this();
+        for (const auto &observer: currentObservers) {
+            observer->tramStatusChangedAsync(tram, stockNumber, status, []() {},
+                                             [self, observer](exception_ptr) {
+                                                 if (auto depo = self.lock()) {
+                                                     depo->removeObserver(observer, Ice::Current());
+                                                 }
+                                             });
+        }
+    }
+
+    // ustawia status wszystkim wybranym tramwajom naraz (AMI) i czeka na wszystkie odpowiedzi;
+    // zwraca liczbe tramwajow, ktore przyjely nowy status
+    int setStatusConcurrently(const vector <shared_ptr<TramPrx>> &trams, TramStatus status) {
+        vector <future<void>> replies;
+        for (const auto &tram: trams) {
+            replies.push_back(tram->setStatusAsync(status));
+        }
+        int changed = 0;
+        for (size_t i = 0; i < trams.size(); ++i) {
+            try {
+                replies.at(i).get();
+                statusChanged(trams.at(i), status);
+                changed++;
+            } catch (const Ice::Exception &e) {
+                cout << "Tramwaj nie odpowiada: " << e << endl;
+            }
+        }
+        return changed;
+    }
+
+    template<typename Predicate>
+    vector <shared_ptr<TramPrx>> select(Predicate predicate) {
+        lock_guard <mutex> lock(depoMutex);
+        vector <shared_ptr<TramPrx>> selected;
+        for (const auto &entry: fleet) {
+            if (predicate(entry.second)) {
+                selected.push_back(entry.second.tram);
+            }
+        }
+        return selected;
+    }
+
+public:
+    DepoI(string name, shared_ptr <NetworkTopology> topology) : topology(topology) {
+        this->name = name;
+    }
+
+    void addObserver(shared_ptr <DepoObserverPrx> observer, const Ice::Current &current) override {
+        lock_guard <mutex> lock(depoMutex);
+        observers.push_back(observer);
+    }
+
+    void removeObserver(shared_ptr <DepoObserverPrx> observer, const Ice::Current &current) override {
+        lock_guard <mutex> lock(depoMutex);
+        for (auto it = observers.begin(); it != observers.end(); ++it) {
+            if ((*it)->ice_getIdentity() == observer->ice_getIdentity()) {
+                observers.erase(it);
+                break;
+            }
+        }
+    }
+
+    void TramOnline(::std::shared_ptr <TramPrx> tram, const Ice::Current &current) override {
+        if (tram) {
+            tram->setStatus(SIP::TramStatus::ONLINE, Ice::Context());
+            statusChanged(tram, SIP::TramStatus::ONLINE);
+            cout << "Tramwaj " << tram->getStockNumber() << " wyjechal z zajezdni" << endl;
+        } else {
+            cout << "Dany Tramwaj nie istnieje" << endl;
+        }
+    }
+
+    void TramOffline(::std::shared_ptr <TramPrx> tram, const Ice::Current &current) override {
+        if (tram) {
+            tram->setStatus(SIP::TramStatus::OFFLINE, Ice::Context());
+            statusChanged(tram, SIP::TramStatus::OFFLINE);
+            cout << "Tramwaj " << tram->getStockNumber() << " zjechal do zajezdni" << endl;
+        } else {
+            cout << "Dany Tramwaj nie istnieje" << endl;
+        }
+    }
+
+    int dispatchAll(const Ice::Current &current) override {
+        int dispatched = setStatusConcurrently(select([](const FleetEntry &entry) {
+            return entry.status == SIP::TramStatus::WAITONLINE;
+        }), SIP::TramStatus::ONLINE);
+        cout << "Wyjechalo z zajezdni tramwajow: " << dispatched << endl;
+        return dispatched;
+    }
+
+    int dispatchLine(string line, const Ice::Current &current) override {
+        int dispatched = setStatusConcurrently(select([&line](const FleetEntry &entry) {
+            return entry.status == SIP::TramStatus::WAITONLINE && entry.line == line;
+        }), SIP::TramStatus::ONLINE);
+        cout << "Wyjechalo z zajezdni na linie " << line << " tramwajow: " << dispatched << endl;
+        return dispatched;
+    }
+
+    int recallAll(const Ice::Current &current) override {
+        int recalled = setStatusConcurrently(select([](const FleetEntry &entry) {
+            return entry.status != SIP::TramStatus::OFFLINE;
+        }), SIP::TramStatus::OFFLINE);
+        cout << "Zjechalo do zajezdni tramwajow: " << recalled << endl;
+        return recalled;
+    }
+
+    FleetList getFleet(const Ice::Current &current) override {
+        lock_guard <mutex> lock(depoMutex);
+        FleetList fleetList;
+        for (const auto &tramInfo: all_trams) {
+            auto found = fleet.find(key(tramInfo.tram));
+            if (found != fleet.end()) {
+                fleetList.push_back(found->second);
+            }
+        }
+        return fleetList;
+    }
+
+    string getName(const Ice::Current &current) override {
+        return name;
+    }
+
+    void registerTram(::std::shared_ptr <TramPrx> tram, const Ice::Current &current) override {
+        TramInfo tramInfo;
+        tramInfo.tram = tram;
+        FleetEntry entry;
+        entry.tram = tram;
+        entry.stockNumber = tram->getStockNumber();
+        auto line = tram->getLine();
+        entry.line = line ? topology->getLineName(line->ice_getIdentity()) : "";
+        entry.status = SIP::TramStatus::WAITONLINE;
+        tramInfo.tram->setStatus(SIP::TramStatus::WAITONLINE, Ice::Context());
+        {
+            lock_guard <mutex> lock(depoMutex);
+            if (!fleet.count(key(tram))) {
+                all_trams.push_back(tramInfo);
+            }
+            fleet[key(tram)] = entry;
+        }
+        statusChanged(tram, SIP::TramStatus::WAITONLINE);
+        cout << "Zajezdnia zarejestrowala tramwaj o numerze: " << entry.stockNumber << endl;
+    };
+
+    void unregisterTram(::std::shared_ptr <TramPrx> tram, const Ice::Current &current) override {
+        TramInfo tramInfo;
+        tramInfo.tram = tram;
+        tramInfo.tram->setStatus(SIP::TramStatus::WAITOFFLINE, Ice::Context());
+        statusChanged(tram, SIP::TramStatus::WAITOFFLINE);
+    };
+
+    TramList getTrams(const Ice::Current &current) override {
+        lock_guard <mutex> lock(depoMutex);
+        return all_trams;
+    };
+};
+
+// Obciazenie procesu fabryki: liczba zywych servantow plus srednia liczba zadan na sekunde,
+// ktore do nich trafiaja. Jeden servant waży tyle, co jedno zadanie na sekunde.
+class LoadMeter {
+private:
+    atomic <Ice::Long> servants{0};
+    atomic <Ice::Long> requests{0};
+    mutex sampleMutex;
+    Ice::Long sampledRequests = 0;
+    chrono::steady_clock::time_point sampledAt = chrono::steady_clock::now();
+    double requestRate = 0;
+public:
+    void servantAdded() {
+        servants++;
+    }
+
+    void servantRemoved() {
+        servants--;
+    }
+
+    void requestDispatched() {
+        requests++;
+    }
+
+    // tempo jest liczone miedzy kolejnymi odczytami i wygladzane, zeby pojedynczy skok nie przerzucal calego ruchu
+    double getLoad() {
+        lock_guard <mutex> lock(sampleMutex);
+        auto now = chrono::steady_clock::now();
+        double elapsed = chrono::duration<double>(now - sampledAt).count();
+        if (elapsed >= 0.1) {
+            Ice::Long total = requests;
+            double rate = (total - sampledRequests) / elapsed;
+            requestRate = 0.5 * requestRate + 0.5 * rate;
+            sampledRequests = total;
+            sampledAt = now;
+        }
+        return static_cast<double>(servants) + requestRate;
+    }
+};
+
+// Przepuszcza kazde wywolanie do servanta, liczac je w LoadMeter fabryki, ktora go utworzyla,
+// i mierzac jego czas jak TimedServant.
+class MeteredServant : public TimedServant {
+private:
+    shared_ptr <LoadMeter> meter;
+public:
+    MeteredServant(shared_ptr <Ice::Object> servant, shared_ptr <LoadMeter> meter)
+            : TimedServant(servant), meter(meter) {
+        meter->servantAdded();
+    }
+
+    ~MeteredServant() {
+        meter->servantRemoved();
+    }
+
+    bool dispatch(Ice::Request &request) override {
+        meter->requestDispatched();
+        return TimedServant::dispatch(request);
+    }
+};
+
+class LineFactoryI : public SIP::LineFactory {
+private:
+    shared_ptr <LoadMeter> meter = make_shared<LoadMeter>();
+    Ice::ObjectAdapterPtr adapter;
+    shared_ptr <NetworkTopology> topology;
+    shared_ptr <IdDirectory> ids;
+public:
+    LineFactoryI(Ice::ObjectAdapterPtr adapter, shared_ptr <NetworkTopology> topology, shared_ptr <IdDirectory> ids)
+            : adapter(adapter), topology(topology), ids(ids) {}
+
+    std::shared_ptr <SIP::LinePrx> createLine(string name, const Ice::Current &current) override {
+        auto newLine = make_shared<LineI>(name, topology, ids);
+
+        auto linePrx = Ice::uncheckedCast<SIP::LinePrx>(
+                adapter->addWithUUID(make_shared<MeteredServant>(newLine, meter)));
+        if (topology) {
+            topology->addLine(name, linePrx);
+        }
+
+        return linePrx;
+    }
+
+    double getLoad(const Ice::Current &current = Ice::Current()) override {
+        return meter->getLoad();
+    }
+};
+
+// Servant locator przystankow (kategoria "stop"). Servant przystanku powstaje przy pierwszym
+// wywolaniu, a w pamieci zostaje najwyzej `capacity` ostatnio uzywanych. Z wyeksmitowanego
+// przystanku zostaje tylko nazwa i - jesli nie jest pusty - jego StopState. Przyjazdy sa
+// trzymane tylko dla `arrivalsCapacity` ostatnio wyeksmitowanych przystankow, bo tramwaje
+// i tak oglaszaja je ponownie co okrazenie; pasazerowie i tramwaje na przystanku zostaja
+// zawsze, wiec pamiec rosnie z liczba subskrybentow, a nie z liczba kiedykolwiek uzytych
+// przystankow. saveState i restoreState sa wolane poza evictorMutex.
+class StopEvictor : public Ice::ServantLocator {
+private:
+    struct Resident {
+        shared_ptr <TramStopI> stop;
+        shared_ptr <Ice::Object> servant;
+        int inUse = 0;
+        // false, dopoki watek, ktory utworzyl servant, odtwarza jego stan
+        bool ready = false;
+        list<string>::iterator position;
+    };
+
+    struct Evicted {
+        StopState state;
+        // pozycja w evictedArrivals albo evictedArrivals.end(), gdy stan nie ma przyjazdow
+        list<string>::iterator arrivals;
+    };
+
+    using Victims = vector <pair<string, shared_ptr<TramStopI>>>;
+
+    size_t capacity;
+    size_t arrivalsCapacity;
+    shared_ptr <NotificationEngine> notifier;
+    shared_ptr <IdDirectory> ids;
+    shared_ptr <LoadMeter> meter;
+    mutex evictorMutex;
+    condition_variable restored;
+    unordered_map <string, string> names;
+    unordered_map <string, Resident> residents;
+    // wyjete z residents, ale ich stan nie zostal jeszcze zapisany
+    unordered_map <string, Resident> evicting;
+    unordered_map <string, Evicted> evicted;
+    // od najdawniej do ostatnio uzywanego
+    list <string> recentlyUsed;
+    // wyeksmitowane przystanki z przyjazdami, od najdawniej wyeksmitowanego
+    list <string> evictedArrivals;
+
+    // wywolywane pod evictorMutex
+    void storeEvicted(const string &id, StopState state) {
+        auto inserted = evicted.emplace(id, Evicted());
+        Evicted &entry = inserted.first->second;
+        if (inserted.second) {
+            entry.arrivals = evictedArrivals.end();
+        }
+        entry.state.append(move(state));
+        if (!entry.state.arrivals.empty() && entry.arrivals == evictedArrivals.end()) {
+            entry.arrivals = evictedArrivals.insert(evictedArrivals.end(), id);
+        }
+        while (evictedArrivals.size() > arrivalsCapacity) {
+            auto oldest = evicted.find(evictedArrivals.front());
+            evictedArrivals.pop_front();
+            oldest->second.state.arrivals.clear();
+            oldest->second.arrivals = evictedArrivals.end();
+            if (oldest->second.state.empty()) {
+                evicted.erase(oldest);
+            }
+        }
+    }
+
+    // wywolywane pod evictorMutex
+    StopState takeEvicted(const string &id) {
+        auto found = evicted.find(id);
+        if (found == evicted.end()) {
+            return StopState();
+        }
+        if (found->second.arrivals != evictedArrivals.end()) {
+            evictedArrivals.erase(found->second.arrivals);
+        }
+        StopState state = move(found->second.state);
+        evicted.erase(found);
+        return state;
+    }
+
+    // Wywolywane pod evictorMutex. Zwraca przystanek z inUse zwiekszonym o jeden (do oddania
+    // przez release) albo nullptr, gdy takiego przystanku nie ma. Blokada moze byc po drodze
+    // zwolniona na czas restoreState.
+    Resident *acquire(const string &id, unique_lock <mutex> &lock) {
+        while (true) {
+            auto resident = residents.find(id);
+            if (resident != residents.end()) {
+                if (!resident->second.ready) {
+                    restored.wait(lock);
+                    continue;
+                }
+                resident->second.inUse++;
+                recentlyUsed.splice(recentlyUsed.end(), recentlyUsed, resident->second.position);
+                return &resident->second;
+            }
+            auto name = names.find(id);
+            if (name == names.end()) {
+                return nullptr;
+            }
+            Resident &created = residents[id];
+            auto pending = evicting.find(id);
+            if (pending != evicting.end()) {
+                // eksmisja jeszcze trwa - wraca ten sam servant z nienaruszonym stanem
+                created = move(pending->second);
+                evicting.erase(pending);
+            } else {
+                created.stop = make_shared<TramStopI>(name->second, notifier, ids);
+                created.servant = make_shared<MeteredServant>(created.stop, meter);
+            }
+            created.inUse = 1;
+            created.position = recentlyUsed.insert(recentlyUsed.end(), id);
+            StopState state = takeEvicted(id);
+            if (state.empty()) {
+                created.ready = true;
+                return &created;
+            }
+            auto stop = created.stop;
+            lock.unlock();
+            stop->restoreState(move(state));
+            lock.lock();
+            restored.notify_all();
+            resident = residents.find(id);
+            // przystanek mogl zostac w tym czasie usuniety
+            if (resident == residents.end() || resident->second.stop != stop) {
+                return nullptr;
+            }
+            resident->second.ready = true;
+            return &resident->second;
+        }
+    }
+
+    // wywolywane pod evictorMutex; przystanki w trakcie wywolania nie sa ruszane
+    Victims collectIdle() {
+        Victims victims;
+        auto it = recentlyUsed.begin();
+        while (residents.size() > capacity && it != recentlyUsed.end()) {
+            auto resident = residents.find(*it);
+            if (resident->second.inUse > 0 || !resident->second.ready) {
+                ++it;
+                continue;
+            }
+            victims.emplace_back(*it, resident->second.stop);
+            evicting[*it] = move(resident->second);
+            residents.erase(resident);
+            it = recentlyUsed.erase(it);
+        }
+        return victims;
+    }
+
+    // wywolywane bez evictorMutex
+    void saveVictims(const Victims &victims) {
+        for (const auto &victim: victims) {
+            StopState state = victim.second->saveState();
+            lock_guard <mutex> lock(evictorMutex);
+            auto pending = evicting.find(victim.first);
+            // przystanek wrocil do pamieci albo zostal usuniety - zapisany stan jest nieaktualny
+            if (pending == evicting.end() || pending->second.stop != victim.second) {
+                continue;
+            }
+            evicting.erase(pending);
+            if (names.count(victim.first) && !state.empty()) {
+                storeEvicted(victim.first, move(state));
+            }
+        }
+    }
+
+    void release(const string &id) {
+        Victims victims;
+        {
+            lock_guard <mutex> lock(evictorMutex);
+            auto resident = residents.find(id);
+            if (resident != residents.end()) {
+                resident->second.inUse--;
+            }
+            victims = collectIdle();
+        }
+        saveVictims(victims);
+    }
+
+public:
+    StopEvictor(size_t capacity, shared_ptr <NotificationEngine> notifier, shared_ptr <IdDirectory> ids,
+                shared_ptr <LoadMeter> meter)
+            : capacity(capacity), arrivalsCapacity(4 * capacity), notifier(notifier), ids(ids), meter(meter) {}
+
+    void add(const string &id, string name) {
+        lock_guard <mutex> lock(evictorMutex);
+        names[id] = name;
+    }
+
+    void remove(const string &id) {
+        lock_guard <mutex> lock(evictorMutex);
+        names.erase(id);
+        takeEvicted(id);
+        evicting.erase(id);
+        auto resident = residents.find(id);
+        if (resident != residents.end()) {
+            recentlyUsed.erase(resident->second.position);
+            residents.erase(resident);
+        }
+        restored.notify_all();
+    }
+
+    size_t residentCount() {
+        lock_guard <mutex> lock(evictorMutex);
+        return residents.size();
+    }
+
+    StopState save(const string &id) {
+        shared_ptr <TramStopI> stop;
+        {
+            unique_lock <mutex> lock(evictorMutex);
+            Resident *resident = acquire(id, lock);
+            if (!resident) {
+                return StopState();
+            }
+            stop = resident->stop;
+        }
+        StopState state = stop->saveState();
+        release(id);
+        return state;
+    }
+
+    void restore(const string &id, StopState state) {
+        if (state.empty()) {
+            return;
+        }
+        shared_ptr <TramStopI> stop;
+        {
+            unique_lock <mutex> lock(evictorMutex);
+            Resident *resident = acquire(id, lock);
+            if (!resident) {
+                return;
+            }
+            stop = resident->stop;
+        }
+        stop->restoreState(move(state));
+        release(id);
+    }
+
+    shared_ptr <Ice::Object> locate(const Ice::Current &current, shared_ptr<void> &cookie) override {
+        shared_ptr <Ice::Object> servant;
+        Victims victims;
+        {
+            unique_lock <mutex> lock(evictorMutex);
+            Resident *resident = acquire(current.id.name, lock);
+            if (!resident) {
+                return nullptr;
+            }
+            servant = resident->servant;
+            victims = collectIdle();
+        }
+        saveVictims(victims);
+        return servant;
+    }
+
+    void finished(const Ice::Current &current, const shared_ptr <Ice::Object> &servant,
+                  const shared_ptr<void> &cookie) override {
+        release(current.id.name);
+    }
+
+    void deactivate(const string &category) override {}
+};
+
+class StopFactoryI : public SIP::StopFactory {
+private:
+    shared_ptr <LoadMeter> meter = make_shared<LoadMeter>();
+    Ice::ObjectAdapterPtr adapter;
+    shared_ptr <NotificationEngine> notifier;
+    shared_ptr <StopEvictor> evictor;
+public:
+    // residentStops - ile servantow przystankow moze byc jednoczesnie w pamieci
+    StopFactoryI(Ice::ObjectAdapterPtr adapter, shared_ptr <NotificationEngine> notifier,
+                 shared_ptr <IdDirectory> ids, size_t residentStops = 1000)
+            : adapter(adapter), notifier(notifier),
+              evictor(make_shared<StopEvictor>(residentStops, notifier, ids, meter)) {
+        adapter->addServantLocator(evictor, "stop");
+    }
+
+    // servant nie jest tworzony - zrobi to StopEvictor przy pierwszym wywolaniu
+    std::shared_ptr <SIP::TramStopPrx> createStop(string name, const Ice::Current &current) override {
+        Ice::Identity id;
+        id.name = Ice::generateUUID();
+        id.category = "stop";
+        evictor->add(id.name, name);
+
+        return Ice::uncheckedCast<SIP::TramStopPrx>(adapter->createProxy(id));
+    }
+
+    // wiele przystankow jednym wywolaniem - dla wczytywania calej sieci
+    TramStopList createStops(NameList names, const Ice::Current &current) override {
+        TramStopList stops;
+        stops.reserve(names.size());
+        for (auto &name: names) {
+            stops.push_back(createStop(move(name), current));
+        }
+        return stops;
+    }
+
+    void destroyStop(std::shared_ptr <SIP::TramStopPrx> stop, const Ice::Current &current) override {
+        evictor->remove(stop->ice_getIdentity().name);
+    }
+
+    StopSnapshot saveStop(std::shared_ptr <SIP::TramStopPrx> stop, const Ice::Current &current) override {
+        return evictor->save(stop->ice_getIdentity().name).toSnapshot();
+    }
+
+    void restoreStop(std::shared_ptr <SIP::TramStopPrx> stop, StopSnapshot state, const Ice::Current &current) override {
+        evictor->restore(stop->ice_getIdentity().name, StopState::fromSnapshot(move(state)));
+    }
+
+    size_t getResidentStops() {
+        return evictor->residentCount();
+    }
+
+    double getLoad(const Ice::Current &current = Ice::Current()) override {
+        return meter->getLoad();
+    }
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <Ice/Ice.h>
+#include "log.h"
+#include <algorithm>
+#include <string>
+#include <thread>
+
+// Tworzy komunikator, ktorego pula watkow serwera ma domyslnie tyle watkow, ile jest rdzeni.
+// Rozmiar mozna nadpisac z linii polecen lub pliku konfiguracyjnego Ice, np.
+// --Ice.ThreadPool.Server.Size=4 --Ice.ThreadPool.Server.SizeMax=16
+// Domyslnie wlaczone sa tez heartbeaty ACM serwera (--Ice.ACM.Server.Heartbeat=3, czyli Always).
+inline Ice::CommunicatorPtr initializeWithThreadPool(int &argc, char *argv[]) {
+    Ice::InitializationData initData;
+    initData.properties = Ice::createProperties(argc, argv);
+    // wlasne ustawienia systemu (--MPK.*) tez sa zdejmowane z argv
+    Ice::StringSeq args = Ice::argsToStringSeq(argc, argv);
+    args = initData.properties->parseCommandLineOptions("MPK", args);
+    Ice::stringSeqToArgs(args, argc, argv);
+    //poziom logow: error, info (domyslnie) albo debug, np. --MPK.LogLevel=debug
+    setLogLevel(initData.properties->getPropertyWithDefault("MPK.LogLevel", "info"));
+
+    std::string cores = std::to_string(std::max(1u, std::thread::hardware_concurrency()));
+    if (initData.properties->getProperty("Ice.ThreadPool.Server.Size").empty()) {
+        initData.properties->setProperty("Ice.ThreadPool.Server.Size", cores);
+    }
+    if (initData.properties->getProperty("Ice.ThreadPool.Server.SizeMax").empty()) {
+        initData.properties->setProperty("Ice.ThreadPool.Server.SizeMax",
+                                         initData.properties->getProperty("Ice.ThreadPool.Server.Size"));
+    }
+    // serwery (takze adapter pasazera) wysylaja heartbeaty, wiec zywe polaczenie nigdy nie jest
+    // bezczynne, a po stronie nadawcy powiadomien ACM wykrywa martwych pasazerow
+    if (initData.properties->getProperty("Ice.ACM.Server.Heartbeat").empty()) {
+        initData.properties->setProperty("Ice.ACM.Server.Heartbeat", "3");
+    }
+    return Ice::initialize(initData);
+}
+
+#endif
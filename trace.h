@@ -0,0 +1,208 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Ice/Ice.h>
+#include "histogram.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+// Zdarzenie przyjazdu tramwaju sledzone od TramI::setNextStop az do dostarczenia pasazerowi.
+// Id i czas powstania (mikrosekundy zegara systemowego, porownywalne miedzy procesami na
+// zsynchronizowanych hostach) jada w kontekscie wywolan Ice, wiec Slice sie nie zmienia.
+struct TraceEvent {
+    Ice::Long id = 0;
+    Ice::Long origin = 0;
+
+    bool traced() const {
+        return id != 0;
+    }
+
+    static TraceEvent fromContext(const Ice::Context &context) {
+        TraceEvent event;
+        auto id = context.find("trace.id");
+        auto origin = context.find("trace.origin");
+        if (id != context.end() && origin != context.end()) {
+            // zepsuty kontekst od klienta - zdarzenie po prostu nie jest sledzone
+            try {
+                event.id = stoll(id->second);
+                event.origin = stoll(origin->second);
+            } catch (const exception &) {
+                event = TraceEvent();
+            }
+        }
+        return event;
+    }
+
+    Ice::Context toContext() const {
+        Ice::Context context;
+        if (traced()) {
+            context["trace.id"] = to_string(id);
+            context["trace.origin"] = to_string(origin);
+        }
+        return context;
+    }
+};
+
+inline Ice::Long nowMicros() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Odcinki (spany) kolejnych etapow zdarzen w buforze cyklicznym bez blokad: zapis zajmuje
+// slot przez fetch_add, a numer sekwencyjny slotu pozwala odczytowi pominac slot nadpisywany
+// w trakcie kopiowania. Najstarsze odcinki sa nadpisywane. Dla kazdego przystanku zbierany jest
+// histogram czasu od przyjazdu tramwaju do dostarczenia powiadomienia pasazerowi.
+class Tracer {
+public:
+    struct Span {
+        Ice::Long eventId;
+        Ice::Long start;
+        Ice::Long end;
+        // zawsze literal, wiec wskaznik zyje dluzej niz bufor
+        const char *hop;
+        char where[40];
+    };
+
+private:
+    static const size_t capacity = 16384;
+
+    struct Slot {
+        atomic<uint64_t> sequence{0};
+        Span span;
+    };
+
+    array<Slot, capacity> slots;
+    atomic<uint64_t> written{0};
+    atomic<Ice::Long> nextEvent{1};
+    // gorne bity id odrozniaja procesy, dolne rosna monotonicznie
+    Ice::Long processTag = static_cast<Ice::Long>(getpid() & 0xffff) << 40;
+
+    shared_timed_mutex latencyMutex;
+    map <string, unique_ptr<Histogram>> arrivalLatency;
+
+    Histogram &latencyOf(const string &stop) {
+        {
+            shared_lock <shared_timed_mutex> lock(latencyMutex);
+            auto found = arrivalLatency.find(stop);
+            if (found != arrivalLatency.end()) {
+                return *found->second;
+            }
+        }
+        unique_lock <shared_timed_mutex> lock(latencyMutex);
+        auto &created = arrivalLatency[stop];
+        if (!created) {
+            created.reset(new Histogram());
+        }
+        return *created;
+    }
+
+public:
+    TraceEvent begin() {
+        TraceEvent event;
+        event.id = processTag | nextEvent.fetch_add(1, memory_order_relaxed);
+        event.origin = nowMicros();
+        return event;
+    }
+
+    void span(const TraceEvent &event, const char *hop, const string &where, Ice::Long start, Ice::Long end) {
+        if (!event.traced()) {
+            return;
+        }
+        uint64_t ticket = written.fetch_add(1, memory_order_relaxed);
+        Slot &slot = slots[ticket % capacity];
+        // nieparzysty numer - slot w trakcie zapisu; bariera nie pozwala zapisom odcinka wyprzedzic
+        // tego numeru (samo release porzadkuje tylko zapisy wczesniejsze)
+        slot.sequence.store(2 * ticket + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot.span.eventId = event.id;
+        slot.span.start = start;
+        slot.span.end = end;
+        slot.span.hop = hop;
+        size_t length = min(where.size(), sizeof(slot.span.where) - 1);
+        memcpy(slot.span.where, where.data(), length);
+        slot.span.where[length] = '\0';
+        slot.sequence.store(2 * ticket + 2, memory_order_release);
+    }
+
+    // powiadomienie o zdarzeniu z przystanku `stop` dotarlo do pasazera
+    void delivered(const TraceEvent &event, const string &stop, Ice::Long sentAt) {
+        if (!event.traced()) {
+            return;
+        }
+        Ice::Long now = nowMicros();
+        span(event, "notify.deliver", stop, sentAt, now);
+        latencyOf(stop).record(static_cast<uint64_t>(max<Ice::Long>(0, now - event.origin)));
+    }
+
+    // kopia odcinkow od najstarszego; sloty nadpisywane w trakcie odczytu sa pomijane
+    vector <Span> spans() {
+        vector <Span> copied;
+        uint64_t end = written.load(memory_order_acquire);
+        uint64_t first = end > capacity ? end - capacity : 0;
+        for (uint64_t ticket = first; ticket < end; ++ticket) {
+            Slot &slot = slots[ticket % capacity];
+            uint64_t before = slot.sequence.load(memory_order_acquire);
+            if (before != 2 * ticket + 2) {
+                continue;
+            }
+            Span span = slot.span;
+            atomic_thread_fence(memory_order_acquire);
+            if (slot.sequence.load(memory_order_relaxed) == before) {
+                copied.push_back(span);
+            }
+        }
+        return copied;
+    }
+
+    // jeden odcinek na wiersz: id zdarzenia, etap, miejsce, poczatek i koniec (us), czas trwania (us)
+    bool dump(const string &path) {
+        ofstream out(path, ios::trunc);
+        if (!out.is_open()) {
+            return false;
+        }
+        for (const auto &span: spans()) {
+            out << span.eventId << "\t" << span.hop << "\t" << span.where << "\t" << span.start << "\t"
+                << span.end << "\t" << span.end - span.start << "\n";
+        }
+        return static_cast<bool>(out);
+    }
+
+    // czasy w mikrosekundach: przystanek -> (liczba, p50, p99, max)
+    template<typename Visitor>
+    void visitLatencies(Visitor visit) {
+        shared_lock <shared_timed_mutex> lock(latencyMutex);
+        for (const auto &stop: arrivalLatency) {
+            visit(stop.first, *stop.second);
+        }
+    }
+
+    void resetLatencies() {
+        shared_lock <shared_timed_mutex> lock(latencyMutex);
+        for (const auto &stop: arrivalLatency) {
+            stop.second->reset();
+        }
+    }
+};
+
+inline Tracer &tracer() {
+    static Tracer instance;
+    return instance;
+}
+
+// plik na slad zdarzen: --MPK.TraceFile albo trace-<pid>.txt, zeby procesy sie nie nadpisywaly
+inline string traceFilePath(const Ice::PropertiesPtr &properties) {
+    return properties->getPropertyWithDefault("MPK.TraceFile", "trace-" + to_string(getpid()) + ".txt");
+}
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef TRAM_H
+#define TRAM_H
+
+#include <Ice/Ice.h>
+#include "MPK.h"
+#include "notifier.h"
+#include "ids.h"
+#include "identityset.h"
+#include "log.h"
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ctime>
+
+using namespace std;
+using namespace SIP;
+
+class TramI : public SIP::Tram, public PassengerOwner {
+private:
+    TramStatus status;
+    string stockNumber;
+    shared_ptr <TramStopPrx> currentStop;
+    IdentitySet <shared_ptr<PassengerPrx>> passengers;
+    shared_ptr <LinePrx> line;
+    StopList lineStops;
+    Ice::Long stopsVersion = -1;
+    int position = 0;
+    std::shared_ptr <TramPrx> selfPrx;
+    shared_ptr <NotificationEngine> notifier;
+    shared_ptr <IdDirectory> ids;
+    Ice::Long knownDead = 0;
+    // chroni stan tramwaju; zdalne wywolania sa zawsze wykonywane poza blokada
+    mutex tramMutex;
+    condition_variable statusChanged;
+
+public:
+    TramI(string stockNumber, shared_ptr <NotificationEngine> notifier, shared_ptr <IdDirectory> ids)
+            : notifier(notifier), ids(ids) {
+        this->stockNumber = stockNumber;
+        this->status = SIP::TramStatus::OFFLINE;
+    };
+
+    void setProxy(std::shared_ptr <TramPrx> prx) {
+        selfPrx = prx;
+    }
+
+    // Ustala czasy dotarcia na przystanki linii, poczawszy od nastepnego, co `perStop` od teraz
+    // i oglasza je na tablicach przyjazdow przystankow jednym wywolaniem na linii. Czas jest
+    // liczony w milisekundach i dopiero na koniec zaokraglany do minuty zegara.
+    void publishTimetable(chrono::milliseconds perStop) {
+        StopList stops;
+        int current;
+        shared_ptr <LinePrx> currentLine;
+        {
+            lock_guard <mutex> lock(tramMutex);
+            stops = lineStops;
+            current = position;
+            currentLine = line;
+        }
+        if (!currentLine || stops.empty()) {
+            return;
+        }
+        StopList timetable;
+        auto now = chrono::system_clock::now();
+        for (size_t ahead = 1; ahead <= stops.size(); ++ahead) {
+            StopInfo stopInfo = stops.at((current + ahead) % stops.size());
+            time_t arrival = chrono::system_clock::to_time_t(now + perStop * static_cast<int>(ahead));
+            tm arrivalTime;
+            localtime_r(&arrival, &arrivalTime);
+            stopInfo.time.hour = arrivalTime.tm_hour;
+            stopInfo.time.minute = arrivalTime.tm_min;
+            timetable.push_back(stopInfo);
+        }
+        currentLine->publishTimetable(selfPrx, timetable);
+    }
+
+
+    // pobiera liste przystankow linii tylko wtedy, gdy zmienila sie jej wersja
+    void refreshStops() {
+        shared_ptr <LinePrx> currentLine;
+        Ice::Long cachedVersion;
+        bool cached;
+        {
+            lock_guard <mutex> lock(tramMutex);
+            currentLine = line;
+            cachedVersion = stopsVersion;
+            cached = !lineStops.empty();
+        }
+        if (!currentLine) {
+            return;
+        }
+        Ice::Long version = currentLine->getStopsVersion();
+        if (version == cachedVersion && cached) {
+            return;
+        }
+        StopList stops = currentLine->getStops();
+        shared_ptr <TramStopPrx> previousStop;
+        {
+            lock_guard <mutex> lock(tramMutex);
+            previousStop = currentStop;
+        }
+        // przystanek przeniesiony do innego shardu ma nowe proxy, ale te sama nazwe
+        int found = -1;
+        if (previousStop) {
+            try {
+                string previousName = ids->stopName(previousStop);
+                for (size_t i = 0; i < stops.size(); ++i) {
+                    if (ids->stopName(stops.at(i).stop) == previousName) {
+                        found = static_cast<int>(i);
+                        break;
+                    }
+                }
+            } catch (const Ice::Exception &ex) {
+                cerr << "Tramwaj " << stockNumber << ": nie mozna ustalic pozycji na linii: " << ex.what() << endl;
+            }
+        }
+
+        lock_guard <mutex> lock(tramMutex);
+        lineStops = stops;
+        stopsVersion = version;
+        position = found == -1 ? 0 : found;
+        // przystanku nie ma juz na linii (albo tramwaj dopiero na nia wjezdza) - zaczyna od pierwszego
+        if (currentStop == previousStop) {
+            currentStop = lineStops.empty() ? nullptr : lineStops.at(position).stop;
+        }
+    }
+
+    void setNextStop() {
+        refreshStops();
+        shared_ptr <TramStopPrx> previousStop;
+        shared_ptr <TramStopPrx> nextStop;
+        {
+            lock_guard <mutex> lock(tramMutex);
+            if (!line || lineStops.empty()) {
+                return;
+            }
+            previousStop = this->currentStop;
+            position = (position + 1) % static_cast<int>(lineStops.size());
+            this->currentStop = lineStops.at(position).stop;
+            nextStop = this->currentStop;
+        }
+        // id i czas przyjazdu jada w kontekscie wywolan az do pasazerow
+        TraceEvent trace = tracer().begin();
+        Ice::Context context = trace.toContext();
+        // niedostepny przystanek nie moze zatrzymac tramwaju - jedzie dalej; kazdy przystanek
+        // osobno, zeby brak poprzedniego nie blokowal ogloszenia na nastepnym
+        if (previousStop) {
+            try {
+                previousStop->removeCurrentTram(selfPrx, context);
+            } catch (const Ice::Exception &ex) {
+                cerr << "Tramwaj " << stockNumber << ": poprzedni przystanek niedostepny: " << ex.what() << endl;
+            }
+        }
+        try {
+            nextStop->addCurrentTram(selfPrx, context);
+        } catch (const Ice::Exception &ex) {
+            cerr << "Tramwaj " << stockNumber << ": przystanek niedostepny: " << ex.what() << endl;
+        }
+        tracer().span(trace, "tram.setNextStop", stockNumber, trace.origin, nowMicros());
+        notifyArrival(nextStop, trace);
+    }
+
+    void notifyArrival(shared_ptr <TramStopPrx> stop, TraceEvent trace = TraceEvent()) {
+        string stopName;
+        try {
+            stopName = ids->stopName(stop);
+        } catch (const Ice::Exception &) {
+            stopName = "?";
+        }
+        string info = "Tramwaj " + this->stockNumber + " dojechal do " + stopName;
+        vector <shared_ptr<PassengerPrx>> subscribers;
+        {
+            lock_guard <mutex> lock(tramMutex);
+            // siatka asekuracyjna dla dropPassenger - przeglad listy tylko, gdy ktos umarl
+            Ice::Long dead = notifier->deadCount();
+            if (dead != knownDead) {
+                knownDead = dead;
+                notifier->dropDead(passengers);
+            }
+            subscribers = passengers.all();
+        }
+        notifier->publish(subscribers, "tram/" + stockNumber, info, trace, stopName);
+    }
+
+    void setLine(shared_ptr <LinePrx> line, const Ice::Current &current) override {
+        {
+            lock_guard <mutex> lock(tramMutex);
+            this->line = line;
+            this->currentStop = nullptr;
+            this->lineStops.clear();
+        }
+        // pierwszy przystanek linii ustawia refreshStops; linia bez przystankow go nie ma
+        refreshStops();
+    }
+
+    shared_ptr <LinePrx> getLine(const Ice::Current &current) override {
+        lock_guard <mutex> lock(tramMutex);
+        return line;
+    }
+
+    shared_ptr <TramStopPrx> getLocation(const Ice::Current &current) override {
+        lock_guard <mutex> lock(tramMutex);
+        return currentStop;
+    };
+
+    int getNextStopIndex() {
+        if (position + 1 < lineStops.size()) {
+            return position + 1;
+        }
+        return -1;
+    };
+
+    StopList getNextStops(int howMany, const Ice::Current &current) override {
+        StopList nextStops;
+
+        refreshStops();
+        lock_guard <mutex> lock(tramMutex);
+        const StopList &allStops = lineStops;
+        int stopIndex = getNextStopIndex();
+
+        if (stopIndex != -1) {
+            for (int i = stopIndex; i < stopIndex + howMany; ++i) {
+                if (i < allStops.size()) {
+                    nextStops.push_back(allStops.at(i));
+                }
+            }
+            for (int i = stopIndex - 2; i >= 0; --i) {
+                if (nextStops.size() < howMany) {
+                    nextStops.push_back(allStops.at(i));
+                }
+            }
+        } else {
+            for (int i = 0; i < static_cast<int>(allStops.size()) - 1; ++i) {
+                if (nextStops.size() < howMany) {
+                    nextStops.push_back(allStops.at(i));
+                }
+            }
+        }
+
+        return nextStops;
+    }
+
+    StopTimeList getNextStopIds(int howMany, const Ice::Current &current) override {
+        StopList nextStops = getNextStops(howMany, current);
+        StopTimeList stopIds;
+        for (const auto &stopInfo: nextStops) {
+            StopTime stopTime;
+            stopTime.stop = ids->stopId(stopInfo.stop);
+            stopTime.minuteOfDay = minuteOfDay(stopInfo.time);
+            stopIds.push_back(stopTime);
+        }
+        return stopIds;
+    }
+
+    void RegisterPassenger(shared_ptr <PassengerPrx> passenger, const Ice::Current &current) override {
+        MPK_LOG(LogLevel::Debug, "Uzytkownik subskrybuje");
+        notifier->revive(passenger);
+        {
+            lock_guard <mutex> lock(tramMutex);
+            // ponowna subskrypcja nie podwaja powiadomien
+            passengers.add(passenger);
+        }
+        notifier->subscribed(passenger, PassengerOwner::shared_from_this());
+    };
+
+    void UnregisterPassenger(shared_ptr <PassengerPrx> passenger, const Ice::Current &current) override {
+        {
+            lock_guard <mutex> lock(tramMutex);
+            if (passengers.remove(passenger->ice_getIdentity())) {
+                MPK_LOG(LogLevel::Debug, "Uzytkownik zakonczyl subskrypcje");
+            }
+        }
+        notifier->unsubscribed(passenger, PassengerOwner::shared_from_this());
+    };
+
+    void dropPassenger(const Ice::Identity &passenger) override {
+        lock_guard <mutex> lock(tramMutex);
+        if (passengers.remove(passenger)) {
+            MPK_LOG(LogLevel::Debug, "Tramwaj " << stockNumber << " usunal niedostepnego pasazera");
+        }
+    }
+
+    string getStockNumber(const Ice::Current &current) override {
+        return stockNumber;
+    }
+
+    TramStatus getStatus(const Ice::Current &current) override {
+        lock_guard <mutex> lock(tramMutex);
+        return status;
+    }
+
+    void setStatus(TramStatus status, const Ice::Current &current) override {
+        {
+            lock_guard <mutex> lock(tramMutex);
+            this->status = status;
+        }
+        statusChanged.notify_all();
+    }
+
+    // blokuje do chwili, gdy zajezdnia ustawi tramwajowi dany status - bez odpytywania
+    void waitForStatus(TramStatus expected) {
+        unique_lock <mutex> lock(tramMutex);
+        statusChanged.wait(lock, [this, expected]() { return status == expected; });
+    }
+};
+
+#endif